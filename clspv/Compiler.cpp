@@ -678,6 +678,11 @@ int RunPassPipeline(llvm::Module &M, llvm::raw_svector_ostream *binaryStream) {
     pm.addPass(llvm::createModuleToFunctionPassAdaptor(llvm::DCEPass()));
     pm.addPass(clspv::UndoBoolPass());
     pm.addPass(clspv::UndoTruncateToOddIntegerPass());
+    // Kernel arguments are still plain pointers here, and the copy loops it
+    // adds still get structurized.
+    if (clspv::Option::PromoteGlobalLoads()) {
+      pm.addPass(clspv::PromoteGlobalLoadsPass());
+    }
     // StructurizeCFG requires LowerSwitch to run first.
     pm.addPass(
         llvm::createModuleToFunctionPassAdaptor(llvm::LowerSwitchPass()));
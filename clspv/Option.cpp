@@ -439,6 +439,21 @@ static llvm::cl::opt<bool> cl_arm_integer_dot_product(
     "cl-arm-integer-dot-product", llvm::cl::init(false),
     llvm::cl::desc("Enable to cl_arm_integer_dot_product extension."));
 
+static llvm::cl::opt<bool> promote_global_loads(
+    "promote-global-loads", llvm::cl::init(false),
+    llvm::cl::desc("Stage __global buffer windows that neighbouring "
+                   "work-items load repeatedly into __local memory."));
+
+static llvm::cl::opt<uint32_t> promote_global_loads_max_local_size(
+    "promote-global-loads-max-local-size", llvm::cl::init(256),
+    llvm::cl::desc("The largest work-group size staged windows are sized for "
+                   "when a kernel has no reqd_work_group_size."));
+
+static llvm::cl::opt<bool> promote_global_loads_report(
+    "promote-global-loads-report", llvm::cl::init(false),
+    llvm::cl::desc("Report the loads that -promote-global-loads staged in "
+                   "__local memory."));
+
 } // namespace
 
 namespace clspv {
@@ -572,5 +587,11 @@ bool ClMadEnable() { return cl_mad_enable; }
 
 bool ArmIntegerDotProduct() { return cl_arm_integer_dot_product; }
 
+bool PromoteGlobalLoads() { return promote_global_loads; }
+uint32_t PromoteGlobalLoadsMaxLocalSize() {
+  return promote_global_loads_max_local_size;
+}
+bool PromoteGlobalLoadsReport() { return promote_global_loads_report; }
+
 } // namespace Option
 } // namespace clspv
@@ -44,6 +44,7 @@
 #include "OpenCLInlinerPass.h"
 #include "PhysicalPointerArgsPass.h"
 #include "PrintfPass.h"
+#include "PromoteGlobalLoadsPass.h"
 #include "RemoveUnusedArguments.h"
 #include "ReorderBasicBlocksPass.h"
 #include "ReplaceLLVMIntrinsicsPass.h"
@@ -0,0 +1,575 @@
+// Copyright 2026 The Clspv Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <utility>
+
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Analysis/CFG.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+
+#include "clspv/AddressSpace.h"
+#include "clspv/Option.h"
+
+#include "Constants.h"
+#include "PromoteGlobalLoadsPass.h"
+#include "SPIRVOp.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "promotegloballoads"
+
+namespace {
+// How deep to look through arithmetic for the terms of an index.
+const unsigned kMaxDepth = 8;
+
+// The widest halo, in elements, that is worth staging around a work-group's
+// window.
+const int64_t kMaxHalo = 64;
+
+// Returns the builtin vector variable |V| reads one component of, or null.
+GlobalVariable *builtinComponent(Value *V, const DataLayout &DL,
+                                 uint64_t &Component) {
+  if (auto *Extract = dyn_cast<ExtractElementInst>(V)) {
+    auto *Index = dyn_cast<ConstantInt>(Extract->getIndexOperand());
+    auto *Load = dyn_cast<LoadInst>(Extract->getVectorOperand());
+    if (!Index || !Load)
+      return nullptr;
+    Component = Index->getZExtValue();
+    return dyn_cast<GlobalVariable>(
+        Load->getPointerOperand()->stripPointerCasts());
+  }
+
+  auto *Load = dyn_cast<LoadInst>(V);
+  if (!Load || !Load->getType()->isIntegerTy(32))
+    return nullptr;
+  APInt Offset(DL.getIndexTypeSizeInBits(Load->getPointerOperandType()), 0);
+  auto *GV = dyn_cast<GlobalVariable>(
+      Load->getPointerOperand()->stripAndAccumulateConstantOffsets(DL, Offset,
+                                                                   true));
+  if (!GV)
+    return nullptr;
+  Component = Offset.getZExtValue() / 4;
+  return GV;
+}
+
+// Merges repeated values and drops the ones that cancel out, so that two
+// indices with the same terms compare equal.
+void canonicalize(SmallVectorImpl<std::pair<Value *, int64_t>> &Terms) {
+  SmallVector<std::pair<Value *, int64_t>, 2> Merged;
+  for (auto &Term : Terms) {
+    auto It = std::find_if(Merged.begin(), Merged.end(),
+                           [&](auto &M) { return M.first == Term.first; });
+    if (It == Merged.end())
+      Merged.push_back(Term);
+    else
+      It->second += Term.second;
+  }
+  Terms.clear();
+  for (auto &Term : Merged) {
+    if (Term.second != 0)
+      Terms.push_back(Term);
+  }
+}
+
+bool sameTerms(ArrayRef<std::pair<Value *, int64_t>> A,
+               ArrayRef<std::pair<Value *, int64_t>> B) {
+  if (A.size() != B.size())
+    return false;
+  for (auto &Term : A) {
+    if (std::find(B.begin(), B.end(), Term) == B.end())
+      return false;
+  }
+  return true;
+}
+
+// Returns the pointers in global memory that |I| may write through.
+SmallVector<Value *, 2> writtenPointers(Instruction &I) {
+  auto IsGlobal = [](Value *Ptr) {
+    auto AS = Ptr->getType()->getPointerAddressSpace();
+    return AS == clspv::AddressSpace::Global ||
+           AS == clspv::AddressSpace::Generic;
+  };
+
+  SmallVector<Value *, 2> Pointers;
+  if (auto *Store = dyn_cast<StoreInst>(&I)) {
+    Pointers.push_back(Store->getPointerOperand());
+  } else if (auto *RMW = dyn_cast<AtomicRMWInst>(&I)) {
+    Pointers.push_back(RMW->getPointerOperand());
+  } else if (auto *CmpXchg = dyn_cast<AtomicCmpXchgInst>(&I)) {
+    Pointers.push_back(CmpXchg->getPointerOperand());
+  } else if (auto *Call = dyn_cast<CallInst>(&I)) {
+    // Atomics and other memory builtins are calls by now.
+    if (Call->onlyReadsMemory())
+      return Pointers;
+    for (auto &Arg : Call->args()) {
+      if (Arg->getType()->isPointerTy())
+        Pointers.push_back(Arg);
+    }
+  }
+
+  Pointers.erase(std::remove_if(Pointers.begin(), Pointers.end(),
+                                [&](Value *Ptr) { return !IsGlobal(Ptr); }),
+                 Pointers.end());
+  return Pointers;
+}
+} // namespace
+
+PreservedAnalyses clspv::PromoteGlobalLoadsPass::run(Module &M,
+                                                     ModuleAnalysisManager &) {
+  PreservedAnalyses PA;
+  if (!clspv::Option::PromoteGlobalLoads())
+    return PA;
+
+  DL = &M.getDataLayout();
+  SmallVector<Function *, 8> Kernels;
+  for (auto &F : M) {
+    if (!F.isDeclaration() && F.getCallingConv() == CallingConv::SPIR_KERNEL)
+      Kernels.push_back(&F);
+  }
+
+  bool Changed = false;
+  for (auto *F : Kernels) {
+    Changed |= runOnKernel(*F);
+  }
+
+  return Changed ? PreservedAnalyses::none() : PA;
+}
+
+bool clspv::PromoteGlobalLoadsPass::runOnKernel(Function &F) {
+  SmallVector<Window, 4> Windows;
+  SmallVector<std::pair<Instruction *, Value *>, 8> Writes;
+  for (auto &BB : F) {
+    for (auto &I : BB) {
+      for (auto *Ptr : writtenPointers(I))
+        Writes.push_back({&I, Ptr});
+
+      auto *Load = dyn_cast<LoadInst>(&I);
+      if (!Load || !Load->isSimple() ||
+          Load->getPointerAddressSpace() != clspv::AddressSpace::Global)
+        continue;
+      auto *Ty = Load->getType();
+      if (!Ty->isIntegerTy(32) && !Ty->isFloatTy())
+        continue;
+
+      Affine A;
+      auto *Buffer = decomposePointer(Load->getPointerOperand(), A);
+      int64_t Size = DL->getTypeStoreSize(Ty);
+      if (!Buffer || A.LocalIdScale != Size || A.Constant % Size != 0)
+        continue;
+      canonicalize(A.Uniform);
+      if (std::any_of(A.Uniform.begin(), A.Uniform.end(),
+                      [Size](auto &Term) { return Term.second % Size != 0; }))
+        continue;
+      for (auto &Term : A.Uniform)
+        Term.second /= Size;
+
+      auto It = std::find_if(Windows.begin(), Windows.end(), [&](Window &W) {
+        return W.Buffer == Buffer && W.ElementTy == Ty &&
+               sameTerms(W.Uniform, A.Uniform);
+      });
+      if (It == Windows.end()) {
+        Windows.push_back({Buffer, Ty, A.Uniform, {}});
+        It = std::prev(Windows.end());
+      }
+      It->Loads.push_back({Load, A.Constant / Size});
+    }
+  }
+
+  DominatorTree DT(F);
+  LoopInfo LI(DT);
+  SmallVector<Window, 4> Promoted;
+  Instruction *StageAt = nullptr;
+  for (auto &W : Windows) {
+    if (!isReadOnly(W.Buffer))
+      continue;
+
+    // The copy is made when the kernel starts, so a load may only read it if
+    // nothing could have written that element before the load. Writes
+    // through other buffers only count if they may alias this one.
+    auto MayAlias = [&W](Value *Ptr) {
+      if (W.Buffer->hasNoAliasAttr())
+        return false;
+      auto *Arg = dyn_cast<Argument>(getUnderlyingObject(Ptr));
+      return !Arg || Arg == W.Buffer || !Arg->hasNoAliasAttr();
+    };
+    W.Loads.erase(
+        std::remove_if(W.Loads.begin(), W.Loads.end(),
+                       [&](auto &Load) {
+                         return std::any_of(
+                             Writes.begin(), Writes.end(), [&](auto &Write) {
+                               return MayAlias(Write.second) &&
+                                      isPotentiallyReachable(Write.first,
+                                                             Load.first,
+                                                             nullptr, &DT, &LI);
+                             });
+                       }),
+        W.Loads.end());
+
+    // Staging only pays off if neighbouring work-items share elements.
+    if (W.Loads.size() < 2)
+      continue;
+    auto Offsets = std::minmax_element(
+        W.Loads.begin(), W.Loads.end(),
+        [](auto &A, auto &B) { return A.second < B.second; });
+    auto Halo = Offsets.second->second - Offsets.first->second;
+    if (Halo == 0 || Halo > kMaxHalo)
+      continue;
+
+    auto *At = stagingPoint(F, W);
+    if (!At)
+      continue;
+    if (!StageAt || StageAt->comesBefore(At))
+      StageAt = At;
+    Promoted.push_back(W);
+  }
+
+  // All windows are copied at the same point, behind one barrier, so drop the
+  // ones with a load ahead of it.
+  Promoted.erase(std::remove_if(Promoted.begin(), Promoted.end(),
+                                [StageAt](Window &W) {
+                                  return std::any_of(
+                                      W.Loads.begin(), W.Loads.end(),
+                                      [StageAt](auto &Load) {
+                                        return Load.first->getParent() ==
+                                                   StageAt->getParent() &&
+                                               Load.first->comesBefore(StageAt);
+                                      });
+                                }),
+                 Promoted.end());
+  if (Promoted.empty())
+    return false;
+  return promote(F, Promoted, StageAt);
+}
+
+Instruction *clspv::PromoteGlobalLoadsPass::stagingPoint(Function &F,
+                                                         const Window &W) {
+  // Everything the copy depends on must be available at one point that every
+  // work-item reaches, ahead of all the loads: in the entry block.
+  BasicBlock &Entry = F.getEntryBlock();
+  Instruction *StageAt = &*Entry.getFirstNonPHIOrDbgOrAlloca();
+  for (auto &Term : W.Uniform) {
+    auto *I = dyn_cast<Instruction>(Term.first);
+    if (!I)
+      continue;
+    if (I->getParent() != &Entry)
+      return nullptr;
+    if (!I->comesBefore(StageAt))
+      StageAt = I->getNextNode();
+  }
+  for (auto &Load : W.Loads) {
+    if (Load.first->getParent() == &Entry && Load.first->comesBefore(StageAt))
+      return nullptr;
+  }
+  return StageAt;
+}
+
+Argument *clspv::PromoteGlobalLoadsPass::decomposePointer(Value *Ptr,
+                                                          Affine &A) {
+  while (true) {
+    Ptr = Ptr->stripPointerCasts();
+    if (auto *Arg = dyn_cast<Argument>(Ptr))
+      return Arg;
+    auto *GEP = dyn_cast<GetElementPtrInst>(Ptr);
+    if (!GEP || GEP->getNumIndices() != 1)
+      return nullptr;
+    int64_t Size = DL->getTypeAllocSize(GEP->getSourceElementType());
+    if (!decompose(GEP->getOperand(1), Size, A, kMaxDepth))
+      return nullptr;
+    Ptr = GEP->getPointerOperand();
+  }
+}
+
+bool clspv::PromoteGlobalLoadsPass::decompose(Value *V, int64_t Scale,
+                                              Affine &A, unsigned Depth) {
+  if (isLocalIdX(V)) {
+    A.LocalIdScale += Scale;
+    return true;
+  }
+  if (auto *C = dyn_cast<ConstantInt>(V)) {
+    A.Constant += C->getSExtValue() * Scale;
+    return true;
+  }
+  if (isWorkGroupUniform(V, kMaxDepth)) {
+    A.Uniform.push_back({V, Scale});
+    return true;
+  }
+
+  auto *I = dyn_cast<Instruction>(V);
+  if (!I || Depth == 0)
+    return false;
+
+  auto ConstantOperand = [I]() {
+    return dyn_cast<ConstantInt>(I->getOperand(1));
+  };
+  switch (I->getOpcode()) {
+  case Instruction::Add:
+    return decompose(I->getOperand(0), Scale, A, Depth - 1) &&
+           decompose(I->getOperand(1), Scale, A, Depth - 1);
+  case Instruction::Or:
+    if (!cast<PossiblyDisjointInst>(I)->isDisjoint())
+      return false;
+    return decompose(I->getOperand(0), Scale, A, Depth - 1) &&
+           decompose(I->getOperand(1), Scale, A, Depth - 1);
+  case Instruction::Sub:
+    return decompose(I->getOperand(0), Scale, A, Depth - 1) &&
+           decompose(I->getOperand(1), -Scale, A, Depth - 1);
+  case Instruction::Mul:
+    if (auto *C = ConstantOperand())
+      return decompose(I->getOperand(0), Scale * C->getSExtValue(), A,
+                       Depth - 1);
+    return false;
+  case Instruction::Shl:
+    if (auto *C = ConstantOperand())
+      return decompose(I->getOperand(0), Scale << C->getZExtValue(), A,
+                       Depth - 1);
+    return false;
+  case Instruction::SExt:
+  case Instruction::ZExt: {
+    // Extending a sum is only the sum of the extended terms if it can't wrap.
+    auto *Op = I->getOperand(0);
+    auto *Sum = dyn_cast<OverflowingBinaryOperator>(Op);
+    bool NoWrap = isLocalIdX(Op) ||
+                  (Sum && (I->getOpcode() == Instruction::SExt
+                               ? Sum->hasNoSignedWrap()
+                               : Sum->hasNoUnsignedWrap()));
+    return NoWrap && decompose(Op, Scale, A, Depth - 1);
+  }
+  default:
+    return false;
+  }
+}
+
+bool clspv::PromoteGlobalLoadsPass::isWorkGroupUniform(Value *V,
+                                                       unsigned Depth) {
+  if (isa<Constant>(V) || isa<Argument>(V))
+    return true;
+
+  uint64_t Component;
+  if (auto *GV = builtinComponent(V, *DL, Component)) {
+    auto Name = GV->getName();
+    return Name == "__spirv_WorkgroupId" ||
+           Name == clspv::WorkgroupSizeVariableName() ||
+           Name == "__spirv_NumWorkgroups" || Name == "__spirv_GlobalOffset";
+  }
+
+  auto *I = dyn_cast<Instruction>(V);
+  if (!I || Depth == 0)
+    return false;
+  if (!isa<BinaryOperator>(I) && !isa<CastInst>(I) && !isa<CmpInst>(I) &&
+      !isa<SelectInst>(I) && !isa<ExtractValueInst>(I))
+    return false;
+  return std::all_of(I->op_begin(), I->op_end(), [&](Use &Op) {
+    return isWorkGroupUniform(Op.get(), Depth - 1);
+  });
+}
+
+bool clspv::PromoteGlobalLoadsPass::isLocalIdX(Value *V) {
+  uint64_t Component;
+  auto *GV = builtinComponent(V, *DL, Component);
+  return GV && Component == 0 &&
+         GV->getName() == clspv::LocalInvocationIdVariableName();
+}
+
+bool clspv::PromoteGlobalLoadsPass::isReadOnly(Argument *Buffer) {
+  SmallVector<Value *, 8> WorkList{Buffer};
+  SmallPtrSet<Value *, 8> Seen{Buffer};
+  while (!WorkList.empty()) {
+    auto *V = WorkList.pop_back_val();
+    for (auto *User : V->users()) {
+      if (isa<LoadInst>(User))
+        continue;
+      if (!isa<GetElementPtrInst>(User) && !isa<BitCastInst>(User) &&
+          !isa<PHINode>(User) && !isa<SelectInst>(User))
+        return false;
+      if (Seen.insert(User).second)
+        WorkList.push_back(User);
+    }
+  }
+  return true;
+}
+
+bool clspv::PromoteGlobalLoadsPass::promote(Function &F,
+                                            ArrayRef<Window> Windows,
+                                            Instruction *StageAt) {
+  Module &M = *F.getParent();
+  auto *LocalIdVar =
+      M.getGlobalVariable(clspv::LocalInvocationIdVariableName());
+  auto *LocalSizeVar = M.getGlobalVariable(clspv::WorkgroupSizeVariableName());
+  const MDNode *ReqdSize = F.getMetadata("reqd_work_group_size");
+  if (!LocalIdVar || (!ReqdSize && !LocalSizeVar))
+    return false;
+
+  // The copies are sized for the largest work-group they can serve. Without a
+  // required work-group size, larger work-groups keep the original loads.
+  uint32_t Capacity = clspv::Option::PromoteGlobalLoadsMaxLocalSize();
+  if (ReqdSize) {
+    Capacity = static_cast<uint32_t>(
+        mdconst::extract<ConstantInt>(ReqdSize->getOperand(0))
+            ->getZExtValue());
+  }
+
+  IRBuilder<> Builder(StageAt);
+  auto *I32 = Builder.getInt32Ty();
+  auto *IdVecTy = FixedVectorType::get(I32, 3);
+  Value *LocalId = Builder.CreateLoad(
+      I32, Builder.CreateGEP(IdVecTy, LocalIdVar,
+                             {Builder.getInt32(0), Builder.getInt32(0)}));
+  Value *LocalSize = nullptr;
+  Value *Fits = nullptr;
+  if (ReqdSize) {
+    LocalSize = Builder.getInt32(Capacity);
+  } else {
+    // Load the whole vector, like the get_local_size() builtin does.
+    LocalSize = Builder.CreateExtractElement(
+        Builder.CreateLoad(IdVecTy, LocalSizeVar), uint64_t(0));
+    Fits = Builder.CreateICmpULE(LocalSize, Builder.getInt32(Capacity));
+  }
+
+  struct Stage {
+    GlobalVariable *Tile;
+    int64_t First;
+  };
+  SmallVector<Stage, 4> Stages;
+  for (auto &W : Windows) {
+    auto Offsets = std::minmax_element(
+        W.Loads.begin(), W.Loads.end(),
+        [](auto &A, auto &B) { return A.second < B.second; });
+    int64_t First = Offsets.first->second;
+    int64_t Halo = Offsets.second->second - First;
+
+    auto *TileTy = ArrayType::get(W.ElementTy, Capacity + Halo);
+    auto *Tile = new GlobalVariable(
+        M, TileTy, false, GlobalValue::InternalLinkage,
+        UndefValue::get(TileTy),
+        F.getName() + ".staged." + W.Buffer->getName(), nullptr,
+        GlobalValue::NotThreadLocal, clspv::AddressSpace::Local);
+    Stages.push_back({Tile, First});
+
+    Builder.SetInsertPoint(StageAt);
+    auto *IndexTy = DL->getIndexType(W.Buffer->getType());
+    Value *Base = ConstantInt::get(IndexTy, First);
+    for (auto &Term : W.Uniform) {
+      Value *V = Builder.CreateSExtOrTrunc(Term.first, IndexTy);
+      if (Term.second != 1)
+        V = Builder.CreateMul(V, ConstantInt::get(IndexTy, Term.second));
+      Base = Builder.CreateAdd(Base, V);
+    }
+
+    // Copy the window with the whole work-group. The trip count is the same
+    // for every work-item, so the barrier after the loop stays in uniform
+    // control flow, as WGSL requires:
+    //   for (k = 0; k < ceil((local_size + halo) / local_size); ++k) {
+    //     i = local_id + k * local_size;
+    //     if (i < local_size + halo)
+    //       tile[i] = buffer[base + i];
+    //   }
+    Instruction *CopyAt = StageAt;
+    if (Fits)
+      CopyAt = SplitBlockAndInsertIfThen(Fits, StageAt, false);
+    BasicBlock *Head = CopyAt->getParent();
+    BasicBlock *Exit = Head->splitBasicBlock(CopyAt, "staged.exit");
+    BasicBlock *Loop =
+        BasicBlock::Create(M.getContext(), "staged.copy", &F, Exit);
+    BasicBlock *Body =
+        BasicBlock::Create(M.getContext(), "staged.copy.body", &F, Exit);
+    BasicBlock *Latch =
+        BasicBlock::Create(M.getContext(), "staged.copy.latch", &F, Exit);
+    Head->getTerminator()->setSuccessor(0, Loop);
+
+    Builder.SetInsertPoint(Head->getTerminator());
+    auto *End = Builder.CreateAdd(LocalSize, Builder.getInt32(Halo));
+    auto *Round = Builder.CreateSub(LocalSize, Builder.getInt32(1));
+    auto *Trips = Builder.CreateUDiv(Builder.CreateAdd(End, Round), LocalSize);
+
+    Builder.SetInsertPoint(Loop);
+    auto *K = Builder.CreatePHI(I32, 2);
+    auto *I = Builder.CreateAdd(LocalId, Builder.CreateMul(K, LocalSize));
+    Builder.CreateCondBr(Builder.CreateICmpULT(I, End), Body, Latch);
+
+    Builder.SetInsertPoint(Body);
+    auto *Src = Builder.CreateGEP(
+        W.ElementTy, W.Buffer,
+        Builder.CreateAdd(Base, Builder.CreateZExtOrTrunc(I, IndexTy)));
+    Builder.CreateStore(
+        Builder.CreateLoad(W.ElementTy, Src),
+        Builder.CreateGEP(TileTy, Tile, {Builder.getInt32(0), I}));
+    Builder.CreateBr(Latch);
+
+    Builder.SetInsertPoint(Latch);
+    auto *Next = Builder.CreateAdd(K, Builder.getInt32(1));
+    Builder.CreateCondBr(Builder.CreateICmpULT(Next, Trips), Loop, Exit);
+    K->addIncoming(Builder.getInt32(0), Head);
+    K->addIncoming(Next, Latch);
+  }
+
+  // Every work-item waits for the copies, whether or not they were made.
+  auto *Scope = Builder.getInt32(spv::ScopeWorkgroup);
+  auto *Semantics =
+      Builder.getInt32(spv::MemorySemanticsAcquireReleaseMask |
+                       spv::MemorySemanticsWorkgroupMemoryMask);
+  clspv::InsertSPIRVOp(StageAt, spv::OpControlBarrier,
+                       {Attribute::NoDuplicate, Attribute::Convergent},
+                       Builder.getVoidTy(), {Scope, Scope, Semantics});
+
+  for (unsigned i = 0; i < Windows.size(); ++i) {
+    auto &W = Windows[i];
+    auto *Tile = Stages[i].Tile;
+    int64_t First = Stages[i].First;
+    int64_t Last = First;
+    for (auto &Load : W.Loads) {
+      auto *Original = Load.first;
+      Last = std::max(Last, Load.second);
+      auto ReadTile = [&](Instruction *Before) {
+        Builder.SetInsertPoint(Before);
+        auto *Index =
+            Builder.CreateAdd(LocalId, Builder.getInt32(Load.second - First));
+        return Builder.CreateLoad(
+            W.ElementTy, Builder.CreateGEP(Tile->getValueType(), Tile,
+                                           {Builder.getInt32(0), Index}));
+      };
+
+      if (!Fits) {
+        Original->replaceAllUsesWith(ReadTile(Original));
+        Original->eraseFromParent();
+        continue;
+      }
+
+      Instruction *ThenTerm, *ElseTerm;
+      SplitBlockAndInsertIfThenElse(Fits, Original, &ThenTerm, &ElseTerm);
+      auto *Staged = ReadTile(ThenTerm);
+      auto *Tail = Original->getParent();
+      Original->moveBefore(ElseTerm);
+      auto *Phi = PHINode::Create(W.ElementTy, 2, "", Tail->begin());
+      Original->replaceAllUsesWith(Phi);
+      Phi->addIncoming(Staged, ThenTerm->getParent());
+      Phi->addIncoming(Original, ElseTerm->getParent());
+    }
+
+    if (clspv::Option::PromoteGlobalLoadsReport()) {
+      errs() << "note: " << F.getName() << ": staged " << W.Loads.size()
+             << " loads of '" << W.Buffer->getName() << "' at offsets ["
+             << First << ", " << Last << "] from get_local_id(0) in "
+             << "__local memory\n";
+    }
+  }
+
+  return true;
+}
@@ -0,0 +1,88 @@
+// Copyright 2026 The Clspv Authors. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassManager.h"
+
+#ifndef _CLSPV_LIB_PROMOTE_GLOBAL_LOADS_PASS_H
+#define _CLSPV_LIB_PROMOTE_GLOBAL_LOADS_PASS_H
+
+namespace clspv {
+// Stages the window of a __global buffer that a work-group reads with loads
+// like in[base + get_local_id(0) + c], where base is the same for the whole
+// work-group, into __local memory. The work-group copies the window
+// cooperatively once, then the loads read the copy.
+struct PromoteGlobalLoadsPass : llvm::PassInfoMixin<PromoteGlobalLoadsPass> {
+  llvm::PreservedAnalyses run(llvm::Module &M, llvm::ModuleAnalysisManager &);
+
+private:
+  // An index decomposed into a sum of terms, in bytes.
+  struct Affine {
+    // Work-group invariant values and their scales.
+    llvm::SmallVector<std::pair<llvm::Value *, int64_t>, 2> Uniform;
+    int64_t LocalIdScale = 0;
+    int64_t Constant = 0;
+  };
+
+  // Loads of one buffer argument, with the same element type and the same
+  // work-group invariant part of the index, at different constant offsets
+  // from get_local_id(0).
+  struct Window {
+    llvm::Argument *Buffer;
+    llvm::Type *ElementTy;
+    // Work-group invariant terms of the element index.
+    llvm::SmallVector<std::pair<llvm::Value *, int64_t>, 2> Uniform;
+    llvm::SmallVector<std::pair<llvm::LoadInst *, int64_t>, 4> Loads;
+  };
+
+  // Returns true if the kernel promoted any loads.
+  bool runOnKernel(llvm::Function &F);
+
+  // Finds the kernel argument |Ptr| points into, and adds its index to |A|.
+  // Returns null if the address isn't a chain of single-index GEPs into an
+  // argument, or an index can't be decomposed.
+  llvm::Argument *decomposePointer(llvm::Value *Ptr, Affine &A);
+
+  // Adds |V| * |Scale| to |A|. Returns false if |V| isn't a sum of
+  // get_local_id(0), constants and work-group invariant values.
+  bool decompose(llvm::Value *V, int64_t Scale, Affine &A, unsigned Depth);
+
+  // Returns true if |V| is the same for every work-item in a work-group.
+  bool isWorkGroupUniform(llvm::Value *V, unsigned Depth);
+
+  // Returns true if |V| is get_local_id(0).
+  bool isLocalIdX(llvm::Value *V);
+
+  // Returns true if nothing stores through |Buffer| or passes it on.
+  bool isReadOnly(llvm::Argument *Buffer);
+
+  // Returns the first point in the entry block where the window can be
+  // copied, or null if there is none ahead of its loads.
+  llvm::Instruction *stagingPoint(llvm::Function &F, const Window &W);
+
+  // Copies the windows into __local memory before |StageAt| and rewrites
+  // their loads to read the copies. Returns false if the kernel doesn't
+  // allow it.
+  bool promote(llvm::Function &F, llvm::ArrayRef<Window> Windows,
+               llvm::Instruction *StageAt);
+
+  const llvm::DataLayout *DL = nullptr;
+};
+} // namespace clspv
+
+#endif // _CLSPV_LIB_PROMOTE_GLOBAL_LOADS_PASS_H
@@ -3494,7 +3494,7 @@ void SPIRVProducerPassImpl::GenerateFuncBody(Function &F) {
 }
 
 spv::Op SPIRVProducerPassImpl::GetSPIRVCmpOpcode(CmpInst *I) {
-  const std::map<CmpInst::Predicate, spv::Op> Map = {
+  static const std::map<CmpInst::Predicate, spv::Op> Map = {
       {CmpInst::ICMP_EQ, spv::OpIEqual},
       {CmpInst::ICMP_NE, spv::OpINotEqual},
       {CmpInst::ICMP_UGT, spv::OpUGreaterThan},
@@ -3524,7 +3524,7 @@ spv::Op SPIRVProducerPassImpl::GetSPIRVCmpOpcode(CmpInst *I) {
 }
 
 spv::Op SPIRVProducerPassImpl::GetSPIRVPointerCmpOpcode(CmpInst *I) {
-  const std::map<CmpInst::Predicate, spv::Op> Map = {
+  static const std::map<CmpInst::Predicate, spv::Op> Map = {
       {CmpInst::ICMP_UGT, spv::OpSGreaterThan},
       {CmpInst::ICMP_UGE, spv::OpSGreaterThanEqual},
       {CmpInst::ICMP_ULT, spv::OpSLessThan},
@@ -3536,7 +3536,7 @@ spv::Op SPIRVProducerPassImpl::GetSPIRVPointerCmpOpcode(CmpInst *I) {
 }
 
 spv::Op SPIRVProducerPassImpl::GetSPIRVCastOpcode(Instruction &I) {
-  const std::map<unsigned, spv::Op> Map{
+  static const std::map<unsigned, spv::Op> Map{
       {Instruction::Trunc, spv::OpUConvert},
       {Instruction::ZExt, spv::OpUConvert},
       {Instruction::SExt, spv::OpSConvert},
@@ -3570,7 +3570,7 @@ spv::Op SPIRVProducerPassImpl::GetSPIRVBinaryOpcode(Instruction &I) {
     }
   }
 
-  const std::map<unsigned, spv::Op> Map{
+  static const std::map<unsigned, spv::Op> Map{
       {Instruction::Add, spv::OpIAdd},
       {Instruction::FAdd, spv::OpFAdd},
       {Instruction::Sub, spv::OpISub},
@@ -310,6 +310,17 @@ bool ClMadEnable();
 // Returns true if cl_arm_integer_dot_product is enabled
 bool ArmIntegerDotProduct();
 
+// Returns true if loads from __global buffers that neighbouring work-items
+// share should be staged in __local memory.
+bool PromoteGlobalLoads();
+
+// Returns the largest work-group size staged loads are sized for, when the
+// kernel doesn't require one. Larger work-groups keep the original loads.
+uint32_t PromoteGlobalLoadsMaxLocalSize();
+
+// Returns true if the loads staged in __local memory should be reported.
+bool PromoteGlobalLoadsReport();
+
 } // namespace Option
 } // namespace clspv
 
@@ -12,10 +12,12 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
 #include <cassert>
 #include <ostream>
 #include <unordered_map>
 #include <iomanip>
+#include <vector>
 
 #include "spirv-tools/libspirv.hpp"
 #include "spirv/unified1/spirv.hpp"
@@ -31,11 +33,16 @@
 namespace {
 class ReflectionParser {
 public:
-  ReflectionParser(std::ostream *ostr) : str(ostr) {}
+  ReflectionParser(std::ostream *ostr, bool printf_table)
+      : str(ostr), collect_printfs(printf_table) {}
 
   // Parses |inst| and emits descriptor map entries as necessary.
   spv_result_t ParseInstruction(const spv_parsed_instruction_t *inst);
 
+  // Writes the printf infos collected so far as a binary table. See
+  // ParseReflection for the layout.
+  void WritePrintfTable(std::ostream *out);
+
 private:
   // Converts the extended instruction to ArgKind.
   clspv::ArgKind GetArgKindFromExtInst(uint32_t value);
@@ -55,6 +62,16 @@ private:
 
   // Maps u32 constant result ids to their values.
   std::unordered_map<uint32_t, uint32_t> constants;
+
+  // Whether printf infos go to the binary table instead of |str|.
+  bool collect_printfs;
+
+  struct PrintfInfo {
+    uint32_t id;
+    std::string format;
+    std::vector<uint32_t> arg_sizes;
+  };
+  std::vector<PrintfInfo> printfs;
 };
 
 spv_result_t ParseInstruction(void *user_data,
@@ -322,6 +339,14 @@ ReflectionParser::ParseInstruction(const spv_parsed_instruction_t *inst) {
         // Emit constant data entry.
         auto printf_id = constants[inst->words[inst->operands[4].offset]];
         const auto &format = strings[inst->words[inst->operands[5].offset]];
+        if (collect_printfs) {
+          PrintfInfo info{printf_id, format, {}};
+          for (size_t i = 6; i < inst->num_operands; i++)
+            info.arg_sizes.push_back(
+                constants[inst->words[inst->operands[i].offset]]);
+          printfs.push_back(std::move(info));
+          break;
+        }
         *str << "printf,id," << printf_id << ",format,";
         for (size_t i = 0; i < format.length(); ++i) {
           *str << std::hex << std::setfill('0') << std::setw(2)
@@ -350,13 +375,44 @@ ReflectionParser::ParseInstruction(const spv_parsed_instruction_t *inst) {
 
   return SPV_SUCCESS;
 }
+
+void ReflectionParser::WritePrintfTable(std::ostream *out) {
+  std::sort(printfs.begin(), printfs.end(),
+            [](const PrintfInfo &a, const PrintfInfo &b) {
+              return a.id < b.id;
+            });
+
+  const uint32_t header_words = 2, entry_words = 5;
+  uint32_t num_args = 0;
+  for (const auto &info : printfs)
+    num_args += info.arg_sizes.size();
+
+  std::vector<uint32_t> words{0x66747270, uint32_t(printfs.size())};
+  uint32_t args_offset =
+      (header_words + entry_words * printfs.size()) * sizeof(uint32_t);
+  uint32_t format_offset = args_offset + num_args * sizeof(uint32_t);
+  for (const auto &info : printfs) {
+    words.insert(words.end(),
+                 {info.id, format_offset, uint32_t(info.format.size()),
+                  args_offset, uint32_t(info.arg_sizes.size())});
+    args_offset += info.arg_sizes.size() * sizeof(uint32_t);
+    format_offset += info.format.size() + 1;
+  }
+  for (const auto &info : printfs)
+    words.insert(words.end(), info.arg_sizes.begin(), info.arg_sizes.end());
+
+  out->write(reinterpret_cast<const char *>(words.data()),
+             words.size() * sizeof(uint32_t));
+  for (const auto &info : printfs)
+    out->write(info.format.c_str(), info.format.size() + 1);
+}
 } // namespace
 
 namespace clspv {
 
 bool ParseReflection(const std::vector<uint32_t> &binary, spv_target_env env,
-                     std::ostream *str) {
-  ReflectionParser parser(str);
+                     std::ostream *str, std::ostream *printf_table) {
+  ReflectionParser parser(str, printf_table != nullptr);
   auto MessageConsumer = [](spv_message_level_t, const char *,
                             const spv_position_t, const char *) {};
   spvtools::Context context(env);
@@ -365,7 +421,11 @@ bool ParseReflection(const std::vector<uint32_t> &binary, spv_target_env env,
   spv_result_t result =
       spvBinaryParse(context.CContext(), &parser, binary.data(), binary.size(),
                      nullptr, ParseInstruction, nullptr);
+  if (result != SPV_SUCCESS)
+    return false;
 
-  return result == SPV_SUCCESS;
+  if (printf_table)
+    parser.WritePrintfTable(printf_table);
+  return true;
 }
 } // namespace clspv
@@ -19,7 +19,18 @@
 
 namespace clspv {
 
+// Writes the descriptor map of |binary| to |str|. If |printf_table| is given,
+// printf infos are written to it as a binary table instead of to |str|, so
+// they can be used without parsing. All fields are little-endian uint32_t and
+// offsets are in bytes from the start of the table:
+//
+//   magic ('prtf'), count
+//   count entries of: id, format offset, format size, args offset, num args
+//   the argument sizes of every entry
+//   the format strings of every entry, each followed by a NUL
+//
+// Entries are sorted by id.
 bool ParseReflection(const std::vector<uint32_t> &binary, spv_target_env env,
-                     std::ostream *str);
+                     std::ostream *str, std::ostream *printf_table = nullptr);
 
 } // namespace clspv
@@ -24,7 +24,8 @@
 
 void PrintUsage() {
   const std::string help =
-      R"(Usage: clspv-reflection [--target-env <env>] [-o <outfile>] <infile>
+      R"(Usage: clspv-reflection [--target-env <env>] [-o <outfile>]
+                        [--printf-table <file>] <infile>
 
 Options:
 --target-env <env>              Specify the SPIR-V environment. Must be one of:
@@ -40,6 +41,9 @@ Options:
                                 If no output file is specified, output goes to
                                 stdout.
 
+--printf-table <file>           Write printf infos to the given file as a
+                                binary table instead of to the output.
+
 -d                              Disable validation.
 )";
 
@@ -49,6 +53,7 @@ Options:
 int clspv_reflection_main(int argc, char * argv[], const llvm::ToolContext &) {
   std::string filename;
   std::string outfile;
+  std::string printf_table;
   bool validate = true;
   spv_target_env env(SPV_ENV_UNIVERSAL_1_0);
   for (int i = 1; i < argc; ++i) {
@@ -78,6 +83,9 @@ int clspv_reflection_main(int argc, char * argv[], const llvm::ToolContext &) {
     } else if (option == "-o") {
       ++i;
       outfile = std::string(argv[i]);
+    } else if (option == "--printf-table") {
+      ++i;
+      printf_table = std::string(argv[i]);
     } else if (option == "-d") {
       validate = false;
     } else if (option[0] == '-') {
@@ -130,7 +138,16 @@ int clspv_reflection_main(int argc, char * argv[], const llvm::ToolContext &) {
       return -1;
     }
   }
-  bool ok = clspv::ParseReflection(binary, env, ostr);
+  std::ofstream printf_str;
+  if (!printf_table.empty()) {
+    printf_str.open(printf_table.c_str(), std::ofstream::binary);
+    if (!printf_str) {
+      std::cerr << "Error: failed to open '" << printf_table << "'\n";
+      return -1;
+    }
+  }
+  bool ok = clspv::ParseReflection(binary, env, ostr,
+                                   printf_table.empty() ? nullptr : &printf_str);
   if (!outfile.empty()) {
     auto fstr = reinterpret_cast<std::ofstream *>(ostr);
     fstr->close();
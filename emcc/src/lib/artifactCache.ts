@@ -0,0 +1,111 @@
+import { clspvArgs, deviceArgs, header, hostArgs, linkArgs } from './compilerFlags';
+
+// Compiled programs are kept across sessions in the Cache API, keyed on a
+// hash of everything that goes into compiling them, so running a program
+// that was compiled before skips the compilers entirely.
+
+export interface Artifacts {
+	reflection: string;
+	printfTable: Uint8Array;
+	bc: Uint8Array;
+	cl: Uint8Array;
+	shader: string;
+	wasm: Uint8Array;
+	wasmMap: string;
+}
+
+// Bump when the compile stages change what they produce without a change to
+// their flags, e.g. a different post-processing of the shader
+export const formatVersion = 3;
+const programCache = 'hipscript-artifacts';
+const maxEntries = 32;
+
+/** SHA-256 of `parts`, as a URL that can be used as a cache key */
+export async function cacheKey(...parts: (string | number | Uint8Array)[]) {
+	const encoder = new TextEncoder();
+	const bytes = parts.map((part) => (part instanceof Uint8Array ? part : encoder.encode(`${part}`)));
+	// each part is prefixed by its length so that the parts can't run together
+	const lengths = new Uint32Array(bytes.map((part) => part.byteLength));
+	const data = await new Blob([lengths, ...bytes]).arrayBuffer();
+	const digest = await crypto.subtle.digest('SHA-256', data);
+	const hex = [...new Uint8Array(digest)].map((b) => b.toString(16).padStart(2, '0')).join('');
+	return new URL(`/artifacts/${hex}`, location.origin).href;
+}
+
+/**
+ * Read the entry stored under `key`. It has a JSON header with the string
+ * fields and the sizes of the `binaries`, which follow it.
+ */
+export async function loadEntry<T>(
+	name: string,
+	key: string,
+	binaries: readonly string[]
+): Promise<T | undefined> {
+	try {
+		const cache = await caches.open(name);
+		const res = await cache.match(key);
+		if (!res) return;
+		const data = new Uint8Array(await res.arrayBuffer());
+		const metaSize = new DataView(data.buffer).getUint32(0, true);
+		const { sizes, ...entry } = JSON.parse(new TextDecoder().decode(data.subarray(4, 4 + metaSize)));
+		let offset = 4 + metaSize;
+		binaries.forEach((binary, i) => {
+			entry[binary] = data.slice(offset, offset + sizes[i]);
+			offset += sizes[i];
+		});
+		return entry;
+	} catch (_) {
+		// treat a broken entry like a missing one
+		return;
+	}
+}
+
+export async function storeEntry(
+	name: string,
+	key: string,
+	entry: Record<string, any>,
+	binaries: readonly string[]
+) {
+	const strings: Record<string, any> = {};
+	for (const field in entry) if (!binaries.includes(field)) strings[field] = entry[field];
+	const parts: Uint8Array[] = binaries.map((binary) => entry[binary] ?? new Uint8Array());
+	const meta = new TextEncoder().encode(
+		JSON.stringify({ ...strings, sizes: parts.map((p) => p.byteLength) })
+	);
+	const metaSize = new Uint8Array(4);
+	new DataView(metaSize.buffer).setUint32(0, meta.byteLength, true);
+	try {
+		const cache = await caches.open(name);
+		await cache.put(key, new Response(new Blob([metaSize, meta, ...parts])));
+		// keys are in insertion order, so this drops the oldest
+		const keys = await cache.keys();
+		for (const request of keys.slice(0, Math.max(keys.length - maxEntries, 0)))
+			cache.delete(request);
+	} catch (_) {
+		// oh well, it'll be compiled again next time
+	}
+}
+
+const programBinaries = ['printfTable', 'bc', 'cl', 'wasm'] as const;
+
+/** The cache key for compiling `contents` with the toolchain at `toolchain` */
+export function artifactKey(contents: string, toolchain: string) {
+	return cacheKey(
+		formatVersion,
+		toolchain,
+		deviceArgs,
+		hostArgs,
+		clspvArgs,
+		linkArgs,
+		JSON.stringify(header),
+		contents
+	);
+}
+
+export function loadArtifacts(key: string) {
+	return loadEntry<Artifacts>(programCache, key, programBinaries);
+}
+
+export function storeArtifacts(key: string, artifacts: Artifacts) {
+	return storeEntry(programCache, key, artifacts, programBinaries);
+}
@@ -0,0 +1,37 @@
+// Everything that decides what the compilers produce for a program, besides
+// its source and the toolchain itself. It's shared by the compiler worker,
+// which runs with it, and the artifact cache, which keys compiled programs on
+// it.
+
+export const sysroot = '/sysroot';
+export const triple = 'wasm32-unknown-emscripten';
+
+// -ftime-trace=main.cpp.json
+
+export const commonArgs = `-cc1 -fcolor-diagnostics -dumpdir a- -disable-free -clear-ast-before-backend -disable-llvm-verifier -fno-rounding-math -mconstructor-aliases -debugger-tuning=gdb -fdebug-compilation-dir=/home -fcoverage-compilation-dir=/home -resource-dir /lib/clang/19 -ferror-limit 19 -fhip-new-launch-api -fgnuc-version=4.2.1 -fdeprecated-macro -fskip-odr-check-in-gmf -I/hip/include/cuspv -D__HIP_PLATFORM_SPIRV__= -D__NVCC__ -D__CHIP_CUDA_COMPATIBILITY__ -Duint=uint32_t -Dulong=uint64_t -std=c++17`;
+
+export const deviceArgs = `${commonArgs} -main-file-name main.cpp -mrelocation-model static -mframe-pointer=all -aux-target-cpu generic -fcuda-is-device -fcuda-allow-variadic-functions -mllvm -vectorize-loops=false -mllvm -vectorize-slp=false -fvisibility=hidden -fapply-global-visibility-to-externs -mlink-builtin-bitcode /hip/lib/hip-device-lib/hipspv-spirv32.bc -isystem /hip/include -isysroot ${sysroot} -internal-isystem ${sysroot}/include/c++/v1 -internal-isystem ${sysroot}/include/c++/v1 -internal-isystem /lib/clang/19/include -internal-isystem ${sysroot}/include -internal-isystem /lib/clang/19/include -internal-isystem ${sysroot}/include -fno-autolink -fcxx-exceptions -fexceptions --offload-new-driver -mllvm -chipstar -triple spirv32 -aux-triple ${triple} -Wspir-compat`;
+
+export const hostArgs = `${commonArgs} -main-file-name main.cpp -target-feature +atomics -target-feature +bulk-memory -target-feature +mutable-globals -target-feature +sign-ext -D __EMSCRIPTEN_SHARED_MEMORY__=1 -D EMSCRIPTEN -pthread -mframe-pointer=none -ffp-contract=on -target-cpu generic -fvisibility=default -debug-info-kind=line-tables-only -isysroot ${sysroot} -internal-isystem ${sysroot}/include/c++/v1 -internal-isystem /lib/clang/19/include -internal-isystem ${sysroot}/include -mrelocation-model pic -pic-level 2 -I/hip/include -discard-value-names -triple ${triple}`;
+
+export const header = {
+	'headers.hh':
+		[
+			'hip/spirv_fixups.h',
+			'cuspv/cuda_runtime.h',
+			'cassert',
+			'vector',
+			'stdexcept',
+			'string',
+			'iostream'
+		]
+			.map((s) => `#include <${s}>\n`)
+			.join('') +
+		`
+        extern template class std::basic_string<char>;
+        extern template class std::vector<int>;`
+};
+
+export const clspvArgs = `-x ir -arch spir - -enable-printf -max-pushconstant-size 0 -inline-entry-points -uniform-workgroup-size -cl-std=CLC++ -o -`;
+
+export const linkArgs = `-mllvm -combiner-global-alias-analysis=false -mllvm -enable-emscripten-sjlj -mllvm -disable-lsr --import-memory --shared-memory --export=__wasm_call_ctors --export=_emscripten_tls_init --export-if-defined=__start_em_asm --export-if-defined=__stop_em_asm --export-if-defined=__start_em_lib_deps --export-if-defined=__stop_em_lib_deps --export-if-defined=__start_em_js --export-if-defined=__stop_em_js --export-if-defined=main --export-if-defined=__main_argc_argv --export-if-defined=__wasm_apply_data_relocs --export-if-defined=fflush --experimental-pic --unresolved-symbols=import-dynamic --no-shlib-sigcheck -shared --no-export-dynamic --print-map --stack-first /home/file.o ${sysroot}/lib/wasm32-emscripten/pic/crtbegin.o -o /home/file.wasm`;
@@ -4,6 +4,7 @@ import CompileWorker from './compiler.worker?worker';
 import ModulePath from './wasm/webgpu_runtime.mjs?worker&url';
 import ModuleBinary from './wasm/webgpu_runtime.wasm?url';
 import llvmManifest from './llvm_manifest.json';
+import { artifactKey, loadArtifacts, storeArtifacts, type Artifacts } from './artifactCache';
 // avoid Emscripten memory leak
 import 'setimmediate';
 
@@ -158,11 +159,13 @@ export interface RunInfo {
 	kernels: KernelInfo[];
 	allKernels: Iterable<string>;
 	timestampsQuantized: boolean;
+	pipelineCache: { hits: number; misses: number };
 }
 
 let codeCache = {
 	contents: '',
 	reflection: '',
+	printfTable: new Uint8Array(),
 	bc: new Uint8Array(),
 	cl: new Uint8Array(),
 	shader: '',
@@ -191,31 +194,41 @@ export async function compile(
 	xterm.loadAddon(ptyController);
 	let device: GPUDevice | undefined;
 	try {
-		let { reflection, bc, cl, shader, wasm, wasmMap } = codeCache;
+		let { reflection, printfTable, bc, cl, shader, wasm, wasmMap } = codeCache;
 		if (codeCache.contents !== contents) {
-			const [p1, p2] = await runCompilers(
-				[
-					{ contents, registry, pch: devicePch, stage: 0 },
-					{ contents, registry, pch: hostPch, stage: 1 }
-				],
-				({ data }, resolve, reject) => {
-					if (data.type === 'res') resolve(data.data);
-					else if (data.type === 'err') reject();
-					else if (data.type === 'feedback') {
-						pty.write(data.data);
-						if (data.err) reject();
+			const key = await artifactKey(contents, piritaDownloadUrl);
+			let artifacts = await loadArtifacts(key);
+			if (artifacts) {
+				pty.write('\x1b[1;92m❯\x1b[0m Using the program compiled in an earlier run\n');
+			} else {
+				const [p1, p2] = await runCompilers(
+					[
+						{ contents, registry, pch: devicePch, stage: 0, toolchain: piritaDownloadUrl },
+						{ contents, registry, pch: hostPch, stage: 1, toolchain: piritaDownloadUrl }
+					],
+					({ data }, resolve, reject) => {
+						if (data.type === 'res') resolve(data.data);
+						else if (data.type === 'err') reject();
+						else if (data.type === 'feedback') {
+							pty.write(data.data);
+							if (data.err) reject();
+						}
 					}
-				}
-			);
-			reflection = p1.reflection;
-			bc = p1.bc;
-			cl = p1.cl;
-			shader = p1.shader;
-			wasm = URL.createObjectURL(new Blob([p2.wasm], { type: 'application/wasm' }));
-			wasmMap = p2.wasmMap;
+				);
+				artifacts = { ...p1, wasm: p2.wasm, wasmMap: p2.wasmMap } as Artifacts;
+				storeArtifacts(key, artifacts);
+			}
+			reflection = artifacts.reflection;
+			printfTable = artifacts.printfTable;
+			bc = artifacts.bc;
+			cl = artifacts.cl;
+			shader = artifacts.shader;
+			wasm = URL.createObjectURL(new Blob([artifacts.wasm], { type: 'application/wasm' }));
+			wasmMap = artifacts.wasmMap;
 			codeCache = {
 				contents,
 				reflection,
+				printfTable,
 				bc,
 				cl,
 				shader,
@@ -227,6 +240,7 @@ export async function compile(
 		download('kernel-ocl.bc', bc);
 		download('kernel.spv', cl);
 		download('kernel.csv', reflection);
+		download('printf.bin', printfTable);
 		download('kernel.wgsl', shader);
 		// console.log(wasmMap);
 		aborter.throwIfAborted();
@@ -296,7 +310,6 @@ export async function compile(
 		const map = reflection;
 		/** @type Map<string, any> */
 		const kernels = new Map();
-		let printfString = '';
 		for (const line of map.split('\n')) {
 			const [ty, name, ...parts] = line.split(',');
 			const data = {};
@@ -305,6 +318,7 @@ export async function compile(
 			}
 			if (ty === 'kernel_decl')
 				kernels.set(name, {
+					name,
 					args: [],
 					dynamic_mem: false,
 					printf: data['printf'] === '1'
@@ -315,11 +329,8 @@ export async function compile(
 				if (data['argKind'] === 'local') kernel.dynamic_mem = +data['arrayElemSize'];
 				if (!['buffer', 'pod_ubo'].includes(data['argKind'])) continue;
 				kernel.args.push(data);
-			} else if (ty === 'printf') {
-				printfString += line + '\n';
 			}
 		}
-		window.printfString = printfString;
 		const wgpuPrintfGroupLayout = device.createBindGroupLayout({
 			entries: [
 				{
@@ -354,7 +365,9 @@ export async function compile(
 				bindGroupLayoutDesc.push({
 					binding: +binding,
 					visibility: GPUShaderStage.COMPUTE,
-					buffer: { type: argKind === 'buffer' ? 'storage' : 'uniform' }
+					// POD arguments are sub-allocated from the runtime's uniform arena
+					buffer:
+						argKind === 'buffer' ? { type: 'storage' } : { type: 'uniform', hasDynamicOffset: true }
 				});
 			}
 			kernel.uniformBuffers = uniformBuffers;
@@ -374,6 +387,65 @@ export async function compile(
 			}
 		}
 
+		// Compiling a pipeline is by far the most expensive part of a launch, and
+		// iterative programs launch the same kernel with the same block size over
+		// and over. Each kernel caches its pipelines on the override constants.
+		const pipelineCacheStats = { hits: 0, misses: 0 };
+		function getPipeline(
+			kernel: any,
+			wgx: number,
+			wgy: number,
+			wgz: number,
+			shared?: number,
+			sync = false
+		): GPUComputePipeline | Promise<GPUComputePipeline> {
+			const key = `${wgx},${wgy},${wgz},${shared ?? ''}`;
+			const pipelineCache: Map<string, GPUComputePipeline | Promise<GPUComputePipeline>> =
+				(kernel.pipelines ??= new Map());
+			const cached = pipelineCache.get(key);
+			if (cached && !(sync && cached instanceof Promise)) {
+				pipelineCacheStats.hits++;
+				return cached;
+			}
+			pipelineCacheStats.misses++;
+			const descriptor: GPUComputePipelineDescriptor = {
+				layout: kernel.pipelineLayout,
+				compute: {
+					module: shaderModule,
+					entryPoint: kernel.name,
+					constants: {
+						_cuda_wgx: wgx,
+						_cuda_wgy: wgy,
+						_cuda_wgz: wgz,
+						...(shared != null && { _cuda_shared: shared })
+					}
+				}
+			};
+			if (sync) {
+				const pipeline = device!.createComputePipeline(descriptor);
+				pipelineCache.set(key, pipeline);
+				return pipeline;
+			}
+			const promise = device!.createComputePipelineAsync(descriptor).then(
+				(pipeline) => {
+					pipelineCache.set(key, pipeline);
+					return pipeline;
+				},
+				(e) => {
+					// let the next launch try again rather than fail the same way
+					if (pipelineCache.get(key) === promise) pipelineCache.delete(key);
+					throw e;
+				}
+			);
+			pipelineCache.set(key, promise);
+			return promise;
+		}
+		// Global initializers run synchronously while the module is loading, so
+		// get their pipelines compiling now, in parallel with each other.
+		const prewarm = [...kernels.values()]
+			.filter((kernel) => kernel.name.startsWith(ChipVarInitPrefix))
+			.map((kernel) => getPipeline(kernel, 1, 1, 1));
+
 		const wgpuPrintfBuffer = device.createBuffer({
 			size: 1048576,
 			usage: GPUBufferUsage.STORAGE | GPUBufferUsage.COPY_SRC | GPUBufferUsage.COPY_DST
@@ -387,22 +459,16 @@ export async function compile(
 			preinitializedWebGPUDevice: device,
 			wgpuShaderModule: shaderModule,
 			wgpuKernelMap: kernels,
+			wgpuGetPipeline: getPipeline,
 			wgpuGlobals: {},
+			wgpuStreams: new Map(),
 			wgpuAnyKernelHasBindings,
 			wgpuPrintfBuffer,
-			wgpuPrintfStagingBuffer: device.createBuffer({
-				size: 1048576,
-				usage: GPUBufferUsage.COPY_DST | GPUBufferUsage.MAP_READ
-			}),
 			wgpuPrintfGroupLayout,
 			wgpuPrintfBindGroup: device.createBindGroup({
 				layout: wgpuPrintfGroupLayout,
 				entries: [{ binding: 0, resource: { buffer: wgpuPrintfBuffer } }]
 			}),
-			wgpuAbortStagingBuffer: device.createBuffer({
-				size: 4,
-				usage: GPUBufferUsage.COPY_DST | GPUBufferUsage.MAP_READ
-			}),
 			...(timestamp
 				? {
 						wgpuTimestampBuffer: device.createBuffer({
@@ -422,8 +488,7 @@ export async function compile(
 			wgpuKernelsRan: [] as KernelInfo[],
 			preInit: () => {
 				const FS = mod.FS;
-				FS.writeFile('/printf.csv', printfString);
-				mod.ENV['PRINTF_BUFFER_SIZE'] = wgpuPrintfBuffer.size;
+				FS.writeFile('/printf.bin', printfTable);
 			},
 			/**
 			 * @param {number} code
@@ -468,6 +533,8 @@ export async function compile(
 		};
 		// the first kernel to use printf is really slow without this
 		device.queue.writeBuffer(mod.wgpuPrintfBuffer, 0, new Uint32Array([0]));
+		// failures are reported again when the initializer is actually dispatched
+		await Promise.allSettled(prewarm);
 		await (await Module).default(mod);
 		aborter.throwIfAborted();
 		function kill() {
@@ -478,6 +545,9 @@ export async function compile(
 		aborter.removeEventListener('abort', kill);
 		mod._stop_bg_threads();
 		setImmediate(() => mod._stop_bg_threads());
+		// the program may exit with launches still queued
+		await Promise.all([...mod.wgpuStreams.values()].map((stream) => stream.tail));
+		await mod.wgpuFlush?.();
 
 		let timestampsQuantized = false;
 		if (mod.wgpuTimestampReadBuffer && mod.wgpuKernelsRan.length) {
@@ -510,7 +580,8 @@ export async function compile(
 			allKernels: [...kernels.keys()].filter(
 				(kernelName) => !kernelName.startsWith(ChipVarInitPrefix)
 			),
-			timestampsQuantized
+			timestampsQuantized,
+			pipelineCache: pipelineCacheStats
 		};
 	} catch (e) {
 		if (e) pty.write('\x1b[1;91m' + e + '\x1b[0m');
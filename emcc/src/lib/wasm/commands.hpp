@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Bounded lock-free queue in the shared heap. Any thread can push, and one
+// thread (the main thread, which owns the WebGPU device) pops. Each slot has a
+// sequence number saying whether it is free to be written or holds a value
+// ready to be read, so producers only contend on claiming a slot.
+template <typename T, size_t Capacity> class CommandRing {
+  static_assert((Capacity & (Capacity - 1)) == 0,
+                "Capacity must be a power of two");
+
+public:
+  CommandRing() {
+    for (size_t i = 0; i < Capacity; i++)
+      Slots[i].Sequence.store(i, std::memory_order_relaxed);
+  }
+
+  // Returns false if the ring is full
+  bool push(const T &Value) {
+    size_t Pos = Tail.load(std::memory_order_relaxed);
+    for (;;) {
+      Slot &S = Slots[Pos % Capacity];
+      size_t Sequence = S.Sequence.load(std::memory_order_acquire);
+      auto Diff = static_cast<intptr_t>(Sequence - Pos);
+      if (Diff == 0) {
+        if (Tail.compare_exchange_weak(Pos, Pos + 1,
+                                       std::memory_order_relaxed)) {
+          S.Value = Value;
+          S.Sequence.store(Pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (Diff < 0) {
+        // the consumer hasn't got to the value in this slot yet
+        return false;
+      } else {
+        Pos = Tail.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Consumer only. Returns false if the ring is empty, or the next value is
+  // still being written.
+  bool pop(T &Value) {
+    Slot &S = Slots[Head % Capacity];
+    if (S.Sequence.load(std::memory_order_acquire) != Head + 1)
+      return false;
+    Value = S.Value;
+    S.Sequence.store(Head + Capacity, std::memory_order_release);
+    Head++;
+    return true;
+  }
+
+  // Consumer only. Passes every value whose slot was claimed before the call
+  // to |Fn|, waiting for any that are still being written, so nothing pushed
+  // before the call is left behind one that is.
+  template <typename F> void drain(F &&Fn) {
+    size_t End = Tail.load(std::memory_order_acquire);
+    T Value;
+    while (Head != End)
+      if (pop(Value))
+        Fn(Value);
+  }
+
+private:
+  struct Slot {
+    std::atomic<size_t> Sequence;
+    T Value;
+  };
+
+  Slot Slots[Capacity];
+  std::atomic<size_t> Tail{0};
+  size_t Head = 0;
+};
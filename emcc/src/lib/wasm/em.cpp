@@ -1,7 +1,10 @@
+#include "commands.hpp"
 #include "hip/hip_runtime_api.h"
 #include "impl.hpp"
+#include "memory.hpp"
 #include "printf.hpp"
 
+#include <atomic>
 #include <cstring>
 #include <emscripten.h>
 #include <emscripten/em_macros.h>
@@ -10,6 +13,7 @@
 #include <emscripten/threading.h>
 #include <fstream>
 #include <unordered_map>
+#include <vector>
 #include <webgpu/webgpu_cpp.h>
 
 // Global WebGPU device and queue
@@ -20,8 +24,80 @@ static wgpu::Queue queue;
 
 static emscripten::ProxyingQueue w_queue;
 
-static std::unordered_map<const void *, const char *> KernelNameMap;
-static std::unordered_map<const void *, wgpu::Buffer> VariableBufferMap;
+struct KernelInfo {
+  // Index of the kernel in the runtime, assigned at registration
+  uint32_t Id;
+  // Bytes of each kernel argument that the device reads; 0 if unused
+  std::vector<uint32_t> ArgSizes;
+  // Pointer arguments bound as storage buffers
+  std::vector<bool> ArgIsBuffer;
+};
+
+static std::unordered_map<const void *, KernelInfo> KernelMap;
+struct VariableInfo {
+  wgpu::Buffer Buffer;
+  void *DevPtr;
+};
+
+static std::unordered_map<const void *, VariableInfo> VariableMap;
+static DeviceMemory Memory;
+
+struct ihipStream_t {
+  uint32_t Id;
+  unsigned int Flags;
+};
+
+static std::atomic<uint32_t> NextStreamId{1};
+
+struct ihipEvent_t {
+  uint32_t Id;
+  unsigned Flags;
+};
+
+static std::atomic<uint32_t> NextEventId{1};
+
+// The null stream, and the legacy and per-thread default streams (which we
+// don't distinguish from it), all map to stream 0
+static uint32_t getStreamId(hipStream_t Stream) {
+  if (Stream == nullptr || Stream == hipStreamLegacy ||
+      Stream == hipStreamPerThread)
+    return 0;
+  return Stream->Id;
+}
+
+// A kernel that failed an assert can't be recovered from, so give up once the
+// host synchronizes with it
+static hipError_t checkAbort(hipError_t res) {
+  if (res == hipErrorAssert)
+    exit(1);
+  return res;
+}
+
+static void runCommands();
+
+// Proxy an API call to the main thread. The call first runs whatever is in the
+// command ring: each producer schedules the ring on its own, so without this
+// the call could overtake work its own thread queued before making it.
+template <typename F> static void proxyAsyncInOrder(F Fn) {
+  w_queue.proxyAsync(emscripten_main_runtime_thread_id(), [Fn] {
+    runCommands();
+    Fn();
+  });
+}
+
+template <typename F> static void proxySyncInOrder(F &&Fn) {
+  w_queue.proxySync(emscripten_main_runtime_thread_id(), [&] {
+    runCommands();
+    Fn();
+  });
+}
+
+template <typename F> static void proxySyncWithCtxInOrder(F &&Fn) {
+  w_queue.proxySyncWithCtx(emscripten_main_runtime_thread_id(), [&](auto ctx) {
+    runCommands();
+    Fn(ctx);
+  });
+}
 
 // Initialize WebGPU device and queue if not already done
 static void initializeWebGPU() {
@@ -31,20 +107,14 @@ static void initializeWebGPU() {
   // Get WebGPU adapter
   device = wgpu::Device::Acquire(emscripten_webgpu_get_device());
 }
-hipError_t EMSCRIPTEN_KEEPALIVE hipMalloc(void **ptr, size_t size) {
-  if (!ptr)
-    RETURN(hipErrorInvalidValue);
-  if (size == 0) {
-    *ptr = nullptr;
-    return hipSuccess;
-  }
-
-  // Create buffer
-
+// Create a storage buffer on the main thread. Returns its WebGPU.mgrBuffer id,
+// or 0 if it couldn't be created.
+static uint32_t createDeviceBuffer(size_t size) {
   wgpu::Buffer buffer;
   std::pair d{&buffer, emscripten::ProxyingQueue::ProxyingCtx{}};
   w_queue.proxySyncWithCtx(emscripten_main_runtime_thread_id(), [&](auto ctx) {
     d.second = ctx;
+    initializeWebGPU();
     wgpu::BufferDescriptor bufferDesc = {};
     bufferDesc.usage = wgpu::BufferUsage::Storage | wgpu::BufferUsage::CopyDst |
                        wgpu::BufferUsage::CopySrc;
@@ -80,56 +150,357 @@ hipError_t EMSCRIPTEN_KEEPALIVE hipMalloc(void **ptr, size_t size) {
         },
         &d);
   });
-  if (!buffer) {
-    RETURN(hipErrorOutOfMemory);
+  if (!buffer)
+    return 0;
+  return reinterpret_cast<uintptr_t>(buffer.MoveToCHandle());
+}
+
+hipError_t EMSCRIPTEN_KEEPALIVE hipMalloc(void **ptr, size_t size) {
+  if (!ptr)
+    RETURN(hipErrorInvalidValue);
+  if (size == 0) {
+    *ptr = nullptr;
+    return hipSuccess;
   }
 
-  *ptr = reinterpret_cast<void *>(
-      reinterpret_cast<uintptr_t>(buffer.MoveToCHandle()) * 8);
+  *ptr = Memory.allocate(size, createDeviceBuffer);
+  if (!*ptr)
+    RETURN(hipErrorOutOfMemory);
   return hipSuccess;
 }
 
-static uintptr_t user_buffer_start = 0;
+// Translate a device address to the buffer holding it. Fails unless Size
+// bytes from the address are inside one allocation.
+static bool resolveDevicePtr(const void *Ptr, size_t Size,
+                             DeviceRegion &Region) {
+  return Memory.lookup(Ptr, Region) && Region.Size >= Size;
+}
+
+extern "C" {
+extern void wasm_hipFree(void *ptr, uint32_t buffer);
+}
+
+extern "C" void EMSCRIPTEN_KEEPALIVE wasm_releaseDeviceMemory(void *ptr) {
+  Memory.finishRelease(ptr);
+}
 
 hipError_t EMSCRIPTEN_KEEPALIVE hipFree(void *ptr) {
   if (ptr == nullptr)
     return hipSuccess;
-  if (reinterpret_cast<uintptr_t>(ptr) < user_buffer_start) {
+  uint32_t Buffer = 0;
+  if (!Memory.beginRelease(ptr, &Buffer))
     RETURN(hipErrorInvalidValue);
-  }
 
-  std::pair d{false, emscripten::ProxyingQueue::ProxyingCtx{}};
-  w_queue.proxySyncWithCtx(emscripten_main_runtime_thread_id(), [&](auto ctx) {
-    d.second = ctx;
-    device.PushErrorScope(wgpu::ErrorFilter::Validation);
-    wgpu::Buffer buffer =
-        wgpu::Buffer::Acquire(reinterpret_cast<WGPUBufferImpl *>(
-            reinterpret_cast<uintptr_t>(ptr) / 8));
-    buffer.Destroy();
-    buffer = nullptr;
+  // Work queued before the free may still use the memory, so the runtime
+  // hands it back with wasm_releaseDeviceMemory once that work is recorded
+  proxyAsyncInOrder([=] { wasm_hipFree(ptr, Buffer); });
+  return hipSuccess;
+}
 
-    device.PopErrorScope(
-        [](WGPUErrorType type, char const *message, void *ctx) {
-          auto &data = *reinterpret_cast<decltype(d) *>(ctx);
-          if (message) {
-            printf("\x1b[1;93m%s\x1b[0m\n", message);
-          }
-          if (type) {
-            data.first = true;
-          }
+extern "C" {
+extern void wasm_hipMemcpy(decltype(emscripten_proxy_finish) cb,
+                           em_proxying_ctx *, hipError_t *, uint32_t stream,
+                           const void *dst, uint32_t dstOffset,
+                           const void *src, uint32_t srcOffset,
+                           size_t sizeBytes, hipMemcpyKind kind);
+extern void wasm_hipMemcpy3D(decltype(emscripten_proxy_finish) cb,
+                             em_proxying_ctx *, hipError_t *, uint32_t stream,
+                             const void *dst, uint32_t dstOffset,
+                             size_t dstPitch, size_t dstSlicePitch,
+                             const void *src, uint32_t srcOffset,
+                             size_t srcPitch, size_t srcSlicePitch,
+                             size_t width, size_t height, size_t depth,
+                             hipMemcpyKind kind);
+extern void wasm_hipMemset(uint32_t stream, const void *dst, uint32_t dstOffset,
+                           uint32_t value, uint32_t elementSize,
+                           size_t sizeBytes);
+extern void wasm_hipLaunchKernel(uint32_t stream, uint32_t kernel,
+                                 uint32_t gx, uint32_t gy, uint32_t gz,
+                                 uint32_t bx, uint32_t by, uint32_t bz,
+                                 void **Args, size_t SharedMem);
+extern void wasm_hipStreamCreate(uint32_t stream, int nonBlocking);
+extern void wasm_hipStreamDestroy(uint32_t stream);
+extern void wasm_hipStreamSynchronize(decltype(emscripten_proxy_finish) cb,
+                                      em_proxying_ctx *, hipError_t *,
+                                      uint32_t stream);
+extern void wasm_hipDeviceSynchronize(decltype(emscripten_proxy_finish) cb,
+                                      em_proxying_ctx *, hipError_t *);
+}
 
-          data.second.finish();
-        },
-        &d);
+hipError_t EMSCRIPTEN_KEEPALIVE hipStreamCreateWithFlags(hipStream_t *stream,
+                                                         unsigned int flags) {
+  if (!stream)
+    RETURN(hipErrorInvalidValue);
+  auto *Stream = new ihipStream_t{NextStreamId++, flags};
+  proxyAsyncInOrder([Stream] {
+    wasm_hipStreamCreate(Stream->Id, Stream->Flags & hipStreamNonBlocking);
   });
-  RETURN(d.first ? hipErrorInvalidValue : hipSuccess);
+  *stream = Stream;
+  return hipSuccess;
+}
+
+hipError_t EMSCRIPTEN_KEEPALIVE hipStreamCreate(hipStream_t *stream) {
+  return hipStreamCreateWithFlags(stream, hipStreamDefault);
+}
+
+hipError_t EMSCRIPTEN_KEEPALIVE hipStreamDestroy(hipStream_t stream) {
+  if (getStreamId(stream) == 0)
+    RETURN(hipErrorInvalidResourceHandle);
+  // work already queued on the stream still runs to completion
+  uint32_t Id = stream->Id;
+  proxyAsyncInOrder([Id] { wasm_hipStreamDestroy(Id); });
+  delete stream;
+  return hipSuccess;
+}
+
+hipError_t EMSCRIPTEN_KEEPALIVE hipStreamSynchronize(hipStream_t stream) {
+  uint32_t Id = getStreamId(stream);
+  hipError_t res = hipErrorUnknown;
+  proxySyncWithCtxInOrder([&](auto ctx) {
+    wasm_hipStreamSynchronize(emscripten_proxy_finish, ctx.ctx, &res, Id);
+  });
+  RETURN(checkAbort(res));
+}
+
+hipError_t EMSCRIPTEN_KEEPALIVE hipDeviceSynchronize() {
+  hipError_t res = hipErrorUnknown;
+  proxySyncWithCtxInOrder([&](auto ctx) {
+    wasm_hipDeviceSynchronize(emscripten_proxy_finish, ctx.ctx, &res);
+  });
+  RETURN(checkAbort(res));
+}
+
+extern "C" int wasm_hipWarpSize();
+
+hipError_t EMSCRIPTEN_KEEPALIVE hipDeviceGetAttribute(int *pi,
+                                                      hipDeviceAttribute_t attr,
+                                                      int deviceId) {
+  if (!pi || deviceId != 0)
+    RETURN(hipErrorInvalidValue);
+  switch (attr) {
+  case hipDeviceAttributeWarpSize: {
+    int Size = 0;
+    w_queue.proxySync(emscripten_main_runtime_thread_id(),
+                      [&] { Size = wasm_hipWarpSize(); });
+    // the adapter doesn't promise one subgroup size
+    if (!Size)
+      RETURN(hipErrorNotSupported);
+    *pi = Size;
+    return hipSuccess;
+  }
+  default:
+    RETURN(hipErrorInvalidValue);
+  }
 }
 
 extern "C" {
-extern void wasm_hipMemcpy(decltype(emscripten_proxy_finish) cb,
-                           em_proxying_ctx *, hipError_t *, void *dst,
-                           const void *src, size_t sizeBytes,
-                           hipMemcpyKind kind);
+extern void wasm_hipEventRecord(uint32_t event, uint32_t stream, int timing);
+extern void wasm_hipEventDestroy(uint32_t event);
+extern void wasm_hipEventSynchronize(decltype(emscripten_proxy_finish) cb,
+                                     em_proxying_ctx *, hipError_t *,
+                                     uint32_t event);
+extern hipError_t wasm_hipEventQuery(uint32_t event);
+extern hipError_t wasm_hipEventElapsedTime(float *ms, uint32_t start,
+                                           uint32_t stop);
+}
+
+hipError_t EMSCRIPTEN_KEEPALIVE hipEventCreateWithFlags(hipEvent_t *event,
+                                                        unsigned flags) {
+  if (!event)
+    RETURN(hipErrorInvalidValue);
+  *event = new ihipEvent_t{NextEventId++, flags};
+  return hipSuccess;
+}
+
+hipError_t EMSCRIPTEN_KEEPALIVE hipEventCreate(hipEvent_t *event) {
+  return hipEventCreateWithFlags(event, hipEventDefault);
+}
+
+// Events are recorded on the stream like any other work; the runtime takes a
+// GPU timestamp when the device gets to them
+hipError_t EMSCRIPTEN_KEEPALIVE hipEventRecord(hipEvent_t event,
+                                               hipStream_t stream) {
+  if (!event)
+    RETURN(hipErrorInvalidResourceHandle);
+  uint32_t Id = event->Id, StreamId = getStreamId(stream);
+  int Timing = !(event->Flags & hipEventDisableTiming);
+  proxyAsyncInOrder([=] { wasm_hipEventRecord(Id, StreamId, Timing); });
+  return hipSuccess;
+}
+
+hipError_t EMSCRIPTEN_KEEPALIVE hipEventDestroy(hipEvent_t event) {
+  if (!event)
+    RETURN(hipErrorInvalidResourceHandle);
+  uint32_t Id = event->Id;
+  proxyAsyncInOrder([Id] { wasm_hipEventDestroy(Id); });
+  delete event;
+  return hipSuccess;
+}
+
+hipError_t EMSCRIPTEN_KEEPALIVE hipEventSynchronize(hipEvent_t event) {
+  if (!event)
+    RETURN(hipErrorInvalidResourceHandle);
+  hipError_t res = hipErrorUnknown;
+  proxySyncWithCtxInOrder([&](auto ctx) {
+    wasm_hipEventSynchronize(emscripten_proxy_finish, ctx.ctx, &res,
+                             event->Id);
+  });
+  RETURN(checkAbort(res));
+}
+
+hipError_t EMSCRIPTEN_KEEPALIVE hipEventQuery(hipEvent_t event) {
+  if (!event)
+    RETURN(hipErrorInvalidResourceHandle);
+  hipError_t res = hipErrorUnknown;
+  proxySyncInOrder([&] { res = wasm_hipEventQuery(event->Id); });
+  // not ready isn't an error
+  return res;
+}
+
+hipError_t EMSCRIPTEN_KEEPALIVE hipEventElapsedTime(float *ms,
+                                                    hipEvent_t start,
+                                                    hipEvent_t stop) {
+  if (!ms)
+    RETURN(hipErrorInvalidValue);
+  if (!start || !stop)
+    RETURN(hipErrorInvalidResourceHandle);
+  hipError_t res = hipErrorUnknown;
+  proxySyncInOrder(
+      [&] { res = wasm_hipEventElapsedTime(ms, start->Id, stop->Id); });
+  RETURN(res);
+}
+
+// The two sides of a copy as the runtime sees them: a host pointer, or the id
+// of a device buffer and an offset into it
+struct CopyEnds {
+  const void *Dst;
+  uint32_t DstOffset;
+  const void *Src;
+  uint32_t SrcOffset;
+};
+
+// Resolve the device sides of a copy, working out the direction first for
+// hipMemcpyDefault. Fails if the bytes a device side spans aren't inside one
+// allocation.
+static bool resolveCopy(const void *dst, size_t dstSpan, const void *src,
+                        size_t srcSpan, hipMemcpyKind &kind, CopyEnds &Ends) {
+  DeviceRegion DstRegion, SrcRegion;
+  if (kind == hipMemcpyDefault) {
+    bool DstDevice = Memory.lookup(dst, DstRegion);
+    bool SrcDevice = Memory.lookup(src, SrcRegion);
+    kind = DstDevice ? (SrcDevice ? hipMemcpyDeviceToDevice
+                                  : hipMemcpyHostToDevice)
+                     : (SrcDevice ? hipMemcpyDeviceToHost
+                                  : hipMemcpyHostToHost);
+  }
+  Ends = {dst, 0, src, 0};
+  if (kind == hipMemcpyHostToDevice || kind == hipMemcpyDeviceToDevice) {
+    if (!resolveDevicePtr(dst, dstSpan, DstRegion))
+      return false;
+    Ends.Dst = reinterpret_cast<void *>(uintptr_t{DstRegion.Buffer});
+    Ends.DstOffset = DstRegion.Offset;
+  }
+  if (kind == hipMemcpyDeviceToHost || kind == hipMemcpyDeviceToDevice) {
+    if (!resolveDevicePtr(src, srcSpan, SrcRegion))
+      return false;
+    Ends.Src = reinterpret_cast<void *>(uintptr_t{SrcRegion.Buffer});
+    Ends.SrcOffset = SrcRegion.Offset;
+  }
+  return true;
+}
+
+// Work that is only queued on a stream doesn't need to wait for the main
+// thread. It is written to a ring in the shared heap, and the main thread runs
+// everything in the ring each time it is woken up for it, so a burst of
+// launches or copies costs one proxied call rather than one per operation.
+struct LaunchCommand {
+  uint32_t Kernel;
+  uint32_t Grid[3];
+  uint32_t Block[3];
+  void **Args;
+  size_t SharedMem;
+};
+struct CopyCommand {
+  CopyEnds Ends;
+  size_t DstPitch, DstSlice, SrcPitch, SrcSlice;
+  size_t Width, Height, Depth;
+  hipMemcpyKind Kind;
+};
+struct MemsetCommand {
+  DeviceRegion Region;
+  uint32_t Value;
+  uint32_t ElementSize;
+  size_t Size;
+};
+struct Command {
+  enum KindT { Launch, Copy, Copy3D, Memset } Kind;
+  uint32_t Stream;
+  union {
+    LaunchCommand Launch;
+    CopyCommand Copy;
+    MemsetCommand Memset;
+  } Args;
+};
+
+static CommandRing<Command, 1024> Commands;
+// Whether the main thread has been asked to run the ring and hasn't started
+// yet. Anything pushed before it starts is run by it.
+static std::atomic<bool> CommandsScheduled{false};
+
+static void runCommand(const Command &C) {
+  switch (C.Kind) {
+  case Command::Launch: {
+    const LaunchCommand &L = C.Args.Launch;
+    wasm_hipLaunchKernel(C.Stream, L.Kernel, L.Grid[0], L.Grid[1], L.Grid[2],
+                         L.Block[0], L.Block[1], L.Block[2], L.Args,
+                         L.SharedMem);
+    break;
+  }
+  case Command::Copy: {
+    const CopyCommand &M = C.Args.Copy;
+    wasm_hipMemcpy(nullptr, nullptr, nullptr, C.Stream, M.Ends.Dst,
+                   M.Ends.DstOffset, M.Ends.Src, M.Ends.SrcOffset, M.Width,
+                   M.Kind);
+    break;
+  }
+  case Command::Copy3D: {
+    const CopyCommand &M = C.Args.Copy;
+    wasm_hipMemcpy3D(nullptr, nullptr, nullptr, C.Stream, M.Ends.Dst,
+                     M.Ends.DstOffset, M.DstPitch, M.DstSlice, M.Ends.Src,
+                     M.Ends.SrcOffset, M.SrcPitch, M.SrcSlice, M.Width,
+                     M.Height, M.Depth, M.Kind);
+    break;
+  }
+  case Command::Memset: {
+    const MemsetCommand &F = C.Args.Memset;
+    wasm_hipMemset(C.Stream,
+                   reinterpret_cast<void *>(uintptr_t{F.Region.Buffer}),
+                   F.Region.Offset, F.Value, F.ElementSize, F.Size);
+    break;
+  }
+  }
+}
+
+// Main thread only
+static void runCommands() {
+  CommandsScheduled.store(false);
+  Commands.drain(runCommand);
+}
+
+// Queue C after everything the calling thread has queued before. API calls
+// proxied after this (with the *InOrder helpers) run the ring first, so they
+// see C even if the main thread gets to them before it runs the ring.
+static void enqueueCommand(const Command &C) {
+  pthread_t Main = emscripten_main_runtime_thread_id();
+  while (!Commands.push(C)) {
+    // full, so make room
+    if (emscripten_is_main_runtime_thread())
+      runCommands();
+    else
+      w_queue.proxySync(Main, runCommands);
+  }
+  if (!CommandsScheduled.exchange(true))
+    w_queue.proxyAsync(Main, runCommands);
 }
 
 hipError_t EMSCRIPTEN_KEEPALIVE hipMemcpy(void *dst, const void *src,
@@ -140,25 +511,269 @@ hipError_t EMSCRIPTEN_KEEPALIVE hipMemcpy(void *dst, const void *src,
   if (!dst || !src)
     RETURN(hipErrorInvalidValue);
 
+  CopyEnds Ends;
+  if (!resolveCopy(dst, sizeBytes, src, sizeBytes, kind, Ends))
+    RETURN(hipErrorInvalidValue);
   if (kind == hipMemcpyHostToHost) {
     memcpy(dst, src, sizeBytes);
     return hipSuccess;
   }
   hipError_t res = hipErrorUnknown;
-  w_queue.proxySyncWithCtx(emscripten_main_runtime_thread_id(), [&](auto ctx) {
-    wasm_hipMemcpy(emscripten_proxy_finish, ctx.ctx, &res, dst, src, sizeBytes,
-                   kind);
+  proxySyncWithCtxInOrder([&](auto ctx) {
+    wasm_hipMemcpy(emscripten_proxy_finish, ctx.ctx, &res, 0, Ends.Dst,
+                   Ends.DstOffset, Ends.Src, Ends.SrcOffset, sizeBytes, kind);
   });
-  RETURN(res);
+  RETURN(checkAbort(res));
+}
+
+hipError_t EMSCRIPTEN_KEEPALIVE hipMemcpyAsync(void *dst, const void *src,
+                                               size_t sizeBytes,
+                                               hipMemcpyKind kind,
+                                               hipStream_t stream) {
+  if (sizeBytes == 0)
+    return hipSuccess;
+  if (!dst || !src)
+    RETURN(hipErrorInvalidValue);
+
+  CopyEnds Ends;
+  if (!resolveCopy(dst, sizeBytes, src, sizeBytes, kind, Ends))
+    RETURN(hipErrorInvalidValue);
+  if (kind == hipMemcpyHostToHost) {
+    memcpy(dst, src, sizeBytes);
+    return hipSuccess;
+  }
+  if (kind == hipMemcpyHostToDevice) {
+    // The source may be reused as soon as we return, so copy it now. The
+    // runtime frees the copy once it has been written to the device.
+    void *Copy = malloc(sizeBytes);
+    if (!Copy)
+      RETURN(hipErrorOutOfMemory);
+    memcpy(Copy, src, sizeBytes);
+    Ends.Src = Copy;
+  }
+  Command C{Command::Copy, getStreamId(stream)};
+  C.Args.Copy = {Ends, 0, 0, 0, 0, sizeBytes, 1, 1, kind};
+  enqueueCommand(C);
+  return hipSuccess;
+}
+// Copy Depth slices of Height rows of Width bytes. Each row of a strided copy
+// becomes a buffer copy, all recorded in one batch.
+static hipError_t memcpy3D(void *dst, size_t dpitch, size_t dslice,
+                           const void *src, size_t spitch, size_t sslice,
+                           size_t width, size_t height, size_t depth,
+                           hipMemcpyKind kind, hipStream_t stream, bool Async) {
+  if (width == 0 || height == 0 || depth == 0)
+    return hipSuccess;
+  if (!dst || !src)
+    RETURN(hipErrorInvalidValue);
+  if ((height > 1 && (width > dpitch || width > spitch)) ||
+      (depth > 1 && (height * dpitch > dslice || height * spitch > sslice)))
+    RETURN(hipErrorInvalidValue);
+
+  size_t Total = width * height * depth;
+  bool Contiguous = (height == 1 || (dpitch == width && spitch == width)) &&
+                    (depth == 1 || (dslice == width * height &&
+                                    sslice == width * height));
+  if (Contiguous)
+    return Async ? hipMemcpyAsync(dst, src, Total, kind, stream)
+                 : hipMemcpy(dst, src, Total, kind);
+
+  size_t DstSpan = (depth - 1) * dslice + (height - 1) * dpitch + width;
+  size_t SrcSpan = (depth - 1) * sslice + (height - 1) * spitch + width;
+  CopyEnds Ends;
+  if (!resolveCopy(dst, DstSpan, src, SrcSpan, kind, Ends))
+    RETURN(hipErrorInvalidValue);
+  if (kind == hipMemcpyHostToHost) {
+    for (size_t z = 0; z < depth; z++)
+      for (size_t y = 0; y < height; y++)
+        memcpy(static_cast<char *>(dst) + z * dslice + y * dpitch,
+               static_cast<const char *>(src) + z * sslice + y * spitch,
+               width);
+    return hipSuccess;
+  }
+
+  // Buffer copies work in 4-byte units
+  auto aligned = [](uint32_t Offset, size_t Pitch, size_t Slice) {
+    return Offset % 4 == 0 && Pitch % 4 == 0 && Slice % 4 == 0;
+  };
+  if (width % 4 ||
+      (kind != hipMemcpyDeviceToHost &&
+       !aligned(Ends.DstOffset, dpitch, dslice)) ||
+      (kind != hipMemcpyHostToDevice &&
+       !aligned(Ends.SrcOffset, spitch, sslice)))
+    RETURN(hipErrorInvalidValue);
+
+  if (Async && kind == hipMemcpyHostToDevice) {
+    // Snapshot the source with its rows packed together
+    char *Copy = static_cast<char *>(malloc(Total));
+    if (!Copy)
+      RETURN(hipErrorOutOfMemory);
+    for (size_t z = 0; z < depth; z++)
+      for (size_t y = 0; y < height; y++)
+        memcpy(Copy + (z * height + y) * width,
+               static_cast<const char *>(src) + z * sslice + y * spitch,
+               width);
+    Ends.Src = Copy;
+    spitch = width;
+    sslice = width * height;
+  }
+
+  if (Async) {
+    Command C{Command::Copy3D, getStreamId(stream)};
+    C.Args.Copy = {Ends, dpitch, dslice, spitch, sslice,
+                   width, height, depth, kind};
+    enqueueCommand(C);
+    return hipSuccess;
+  }
+  hipError_t res = hipErrorUnknown;
+  proxySyncWithCtxInOrder([&](auto ctx) {
+    wasm_hipMemcpy3D(emscripten_proxy_finish, ctx.ctx, &res, 0, Ends.Dst,
+                     Ends.DstOffset, dpitch, dslice, Ends.Src, Ends.SrcOffset,
+                     spitch, sslice, width, height, depth, kind);
+  });
+  RETURN(checkAbort(res));
 }
+
+hipError_t EMSCRIPTEN_KEEPALIVE hipMemcpy2D(void *dst, size_t dpitch,
+                                            const void *src, size_t spitch,
+                                            size_t width, size_t height,
+                                            hipMemcpyKind kind) {
+  return memcpy3D(dst, dpitch, 0, src, spitch, 0, width, height, 1, kind,
+                  nullptr, false);
+}
+
+hipError_t EMSCRIPTEN_KEEPALIVE hipMemcpy2DAsync(void *dst, size_t dpitch,
+                                                 const void *src, size_t spitch,
+                                                 size_t width, size_t height,
+                                                 hipMemcpyKind kind,
+                                                 hipStream_t stream) {
+  return memcpy3D(dst, dpitch, 0, src, spitch, 0, width, height, 1, kind,
+                  stream, true);
+}
+
+// Only pitched pointers are supported, not arrays
+static hipError_t memcpy3DParms(const hipMemcpy3DParms *p, hipStream_t stream,
+                                bool Async) {
+  if (!p || p->srcArray || p->dstArray)
+    RETURN(hipErrorInvalidValue);
+  const hipPitchedPtr &Dst = p->dstPtr, &Src = p->srcPtr;
+  size_t DstSlice = Dst.pitch * Dst.ysize, SrcSlice = Src.pitch * Src.ysize;
+  char *DstStart = static_cast<char *>(Dst.ptr) + p->dstPos.z * DstSlice +
+                   p->dstPos.y * Dst.pitch + p->dstPos.x;
+  const char *SrcStart = static_cast<const char *>(Src.ptr) +
+                         p->srcPos.z * SrcSlice + p->srcPos.y * Src.pitch +
+                         p->srcPos.x;
+  return memcpy3D(DstStart, Dst.pitch, DstSlice, SrcStart, Src.pitch, SrcSlice,
+                  p->extent.width, p->extent.height, p->extent.depth, p->kind,
+                  stream, Async);
+}
+
+hipError_t EMSCRIPTEN_KEEPALIVE hipMemcpy3D(const hipMemcpy3DParms *p) {
+  return memcpy3DParms(p, nullptr, false);
+}
+
+hipError_t EMSCRIPTEN_KEEPALIVE hipMemcpy3DAsync(const hipMemcpy3DParms *p,
+                                                 hipStream_t stream) {
+  return memcpy3DParms(p, stream, true);
+}
+
+hipError_t EMSCRIPTEN_KEEPALIVE hipMallocPitch(void **ptr, size_t *pitch,
+                                               size_t width, size_t height) {
+  if (!pitch)
+    RETURN(hipErrorInvalidValue);
+  // Rows start at an offset that can be copied and bound
+  *pitch = (width + DeviceAllocAlignment - 1) / DeviceAllocAlignment *
+           DeviceAllocAlignment;
+  return hipMalloc(ptr, *pitch * height);
+}
+
+hipError_t EMSCRIPTEN_KEEPALIVE hipMalloc3D(hipPitchedPtr *pitchedDevPtr,
+                                            hipExtent extent) {
+  if (!pitchedDevPtr)
+    RETURN(hipErrorInvalidValue);
+  void *Ptr;
+  size_t Pitch;
+  if (hipError_t err = hipMallocPitch(&Ptr, &Pitch, extent.width,
+                                      extent.height * extent.depth))
+    return err;
+  *pitchedDevPtr = {Ptr, Pitch, extent.width, extent.height};
+  return hipSuccess;
+}
+
+// Fill Count elements of ElementSize bytes with Value. Like the memcpy
+// variants, this is queued on the stream without waiting for the main thread;
+// errors are reported by the next synchronization.
+static hipError_t memsetElements(void *dst, uint32_t Value, size_t ElementSize,
+                                 size_t Count, hipStream_t stream) {
+  if (Count == 0)
+    return hipSuccess;
+  DeviceRegion Region;
+  if (!resolveDevicePtr(dst, Count * ElementSize, Region) ||
+      Region.Offset % ElementSize)
+    RETURN(hipErrorInvalidValue);
+  Command C{Command::Memset, getStreamId(stream)};
+  C.Args.Memset = {Region, Value, static_cast<uint32_t>(ElementSize),
+                   Count * ElementSize};
+  enqueueCommand(C);
+  return hipSuccess;
+}
+
+hipError_t EMSCRIPTEN_KEEPALIVE hipMemset(void *dst, int value,
+                                          size_t sizeBytes) {
+  return memsetElements(dst, static_cast<uint8_t>(value), 1, sizeBytes,
+                        nullptr);
+}
+
+hipError_t EMSCRIPTEN_KEEPALIVE hipMemsetAsync(void *dst, int value,
+                                               size_t sizeBytes,
+                                               hipStream_t stream) {
+  return memsetElements(dst, static_cast<uint8_t>(value), 1, sizeBytes,
+                        stream);
+}
+
+hipError_t EMSCRIPTEN_KEEPALIVE hipMemsetD8(hipDeviceptr_t dest,
+                                            unsigned char value, size_t count) {
+  return memsetElements(dest, value, 1, count, nullptr);
+}
+
+hipError_t EMSCRIPTEN_KEEPALIVE hipMemsetD8Async(hipDeviceptr_t dest,
+                                                 unsigned char value,
+                                                 size_t count,
+                                                 hipStream_t stream) {
+  return memsetElements(dest, value, 1, count, stream);
+}
+
+hipError_t EMSCRIPTEN_KEEPALIVE hipMemsetD16(hipDeviceptr_t dest,
+                                             unsigned short value,
+                                             size_t count) {
+  return memsetElements(dest, value, 2, count, nullptr);
+}
+
+hipError_t EMSCRIPTEN_KEEPALIVE hipMemsetD16Async(hipDeviceptr_t dest,
+                                                  unsigned short value,
+                                                  size_t count,
+                                                  hipStream_t stream) {
+  return memsetElements(dest, value, 2, count, stream);
+}
+
+hipError_t EMSCRIPTEN_KEEPALIVE hipMemsetD32(hipDeviceptr_t dest, int value,
+                                             size_t count) {
+  return memsetElements(dest, value, 4, count, nullptr);
+}
+
+hipError_t EMSCRIPTEN_KEEPALIVE hipMemsetD32Async(hipDeviceptr_t dst,
+                                                  int value, size_t count,
+                                                  hipStream_t stream) {
+  return memsetElements(dst, value, 4, count, stream);
+}
+
 hipError_t EMSCRIPTEN_KEEPALIVE hipGetSymbolAddress(void **DevPtr,
                                                     const void *Symbol) {
-  auto it = VariableBufferMap.find(Symbol);
-  if (it == VariableBufferMap.end())
+  auto it = VariableMap.find(Symbol);
+  if (it == VariableMap.end())
     RETURN(hipErrorInvalidSymbol);
 
-  *DevPtr = reinterpret_cast<void *>(
-      reinterpret_cast<uintptr_t>(it->second.Get()) * 8);
+  *DevPtr = it->second.DevPtr;
   return hipSuccess;
 }
 hipError_t EMSCRIPTEN_KEEPALIVE hipMemcpyToSymbol(const void *Symbol,
@@ -166,53 +781,75 @@ hipError_t EMSCRIPTEN_KEEPALIVE hipMemcpyToSymbol(const void *Symbol,
                                                   size_t SizeBytes,
                                                   size_t Offset,
                                                   hipMemcpyKind Kind) {
-  assert(Offset == 0); // FIXME: fix
   void *data;
   if (hipError_t err = hipGetSymbolAddress(&data, Symbol))
     RETURN(err);
-  return hipMemcpy(data, Src, SizeBytes, Kind);
+  return hipMemcpy(static_cast<char *>(data) + Offset, Src, SizeBytes, Kind);
+}
+
+hipError_t EMSCRIPTEN_KEEPALIVE hipMemcpyToSymbolAsync(
+    const void *Symbol, const void *Src, size_t SizeBytes, size_t Offset,
+    hipMemcpyKind Kind, hipStream_t Stream) {
+  void *data;
+  if (hipError_t err = hipGetSymbolAddress(&data, Symbol))
+    RETURN(err);
+  return hipMemcpyAsync(static_cast<char *>(data) + Offset, Src, SizeBytes,
+                        Kind, Stream);
+}
+
+hipError_t EMSCRIPTEN_KEEPALIVE hipMemcpyFromSymbol(void *Dst,
+                                                    const void *Symbol,
+                                                    size_t SizeBytes,
+                                                    size_t Offset,
+                                                    hipMemcpyKind Kind) {
+  void *data;
+  if (hipError_t err = hipGetSymbolAddress(&data, Symbol))
+    RETURN(err);
+  return hipMemcpy(Dst, static_cast<char *>(data) + Offset, SizeBytes, Kind);
+}
+
+hipError_t EMSCRIPTEN_KEEPALIVE hipMemcpyFromSymbolAsync(
+    void *Dst, const void *Symbol, size_t SizeBytes, size_t Offset,
+    hipMemcpyKind Kind, hipStream_t Stream) {
+  void *data;
+  if (hipError_t err = hipGetSymbolAddress(&data, Symbol))
+    RETURN(err);
+  return hipMemcpyAsync(Dst, static_cast<char *>(data) + Offset, SizeBytes,
+                        Kind, Stream);
 }
 
 struct PrintfData {
-  printf_descriptor_map_t map;
-  char *buffer;
-  size_t bufferSize;
+  printf_table table;
   PrintfData() {
-    std::ifstream i("printf.csv");
-    std::string line;
-    while (std::getline(i, line)) {
-      std::stringstream lineStream(line);
-      std::string cell;
-      printf_descriptor desc;
-      uint32_t id;
-      for (int i = 0; std::getline(lineStream, cell, ','); i++) {
-        if (i == 2)
-          id = std::strtol(cell.c_str(), nullptr, 10);
-        if (i == 4) {
-          std::string newString;
-          for (int i = 0; i < cell.length(); i += 2) {
-            std::string byte = cell.substr(i, 2);
-            char chr = (char)(int)strtol(byte.c_str(), nullptr, 16);
-            newString.push_back(chr);
-          }
-          desc.format_string = newString;
-        }
-        if (i == 6) {
-          std::stringstream ss(cell);
-          std::string str;
-          while (getline(ss, str, ';')) {
-            desc.arg_sizes.push_back(std::strtol(str.c_str(), nullptr, 10));
-          }
-        }
-      }
-      map[id] = desc;
-    }
-
-    bufferSize = std::strtol(getenv("PRINTF_BUFFER_SIZE"), nullptr, 10);
-    buffer = new char[bufferSize];
+    std::ifstream i("printf.bin", std::ios::binary | std::ios::ate);
+    // empty when the program has no kernels
+    if (!i || i.tellg() == 0)
+      return;
+    std::vector<uint32_t> words(size_t(i.tellg()) / sizeof(uint32_t));
+    i.seekg(0);
+    i.read(reinterpret_cast<char *>(words.data()),
+           words.size() * sizeof(uint32_t));
+    if (!table.load(std::move(words)))
+      fprintf(stderr, "Invalid printf table\n");
+  }
+  // Print what kernels printed since the last synchronization before exiting
+  ~PrintfData() {
+    if (emscripten_is_main_runtime_thread())
+      return;
+    hipError_t res;
+    proxySyncWithCtxInOrder([&](auto ctx) {
+      wasm_hipDeviceSynchronize(emscripten_proxy_finish, ctx.ctx, &res);
+    });
   }
 } static printfData;
 
+// Kernel printf output is accumulated on the device and drained by the
+// runtime, on the main thread, after the batch that produced it has run
+extern "C" void EMSCRIPTEN_KEEPALIVE wasm_printfDrain(const char *data,
+                                                      size_t size) {
+  cvk_printf(data, size, printfData.table);
+}
+
 // __attribute__((constructor)) static void initializePrintf() {
 
 // }
@@ -275,39 +912,73 @@ hipError_t EMSCRIPTEN_KEEPALIVE __hipPopCallConfiguration(
 }
 
 extern "C" {
-extern void wasm_hipLaunchKernel(decltype(emscripten_proxy_finish) cb,
-                                 em_proxying_ctx *, hipError_t *,
-                                 const char *kernel, uint32_t gx, uint32_t gy,
-                                 uint32_t gz, uint32_t bx, uint32_t by,
-                                 uint32_t bz, void **Args, size_t SharedMem,
-                                 char *printfBuffer);
+extern int wasm_hipKernelInfo(const char *kernel, uint32_t *argSizes,
+                              uint8_t *argIsBuffer, int maxArgs,
+                              uint32_t *kernelId);
+}
+
+// The launch is recorded after hipLaunchKernel has returned, so capture the
+// argument values now, with device pointers translated to a DeviceRegion. The
+// copy keeps the layout of Args and is freed by the runtime once the kernel
+// has been recorded.
+static hipError_t snapshotArgs(const KernelInfo &Kernel, void **Args,
+                               void ***ArgsCopy) {
+  size_t Count = Kernel.ArgSizes.size();
+  auto argSize = [&](size_t i) -> size_t {
+    return Kernel.ArgIsBuffer[i] ? sizeof(DeviceRegion) : Kernel.ArgSizes[i];
+  };
+  size_t Total = 0;
+  for (size_t i = 0; i < Count; i++)
+    Total += (argSize(i) + 7) & ~7;
+  auto **Copy =
+      static_cast<void **>(malloc(Count * sizeof(void *) + Total));
+  if (!Copy)
+    return hipErrorOutOfMemory;
+  char *Data = reinterpret_cast<char *>(Copy + Count);
+  for (size_t i = 0; i < Count; i++) {
+    Copy[i] = Data;
+    if (Kernel.ArgIsBuffer[i]) {
+      // An interior pointer is bound as its slab's buffer at an offset, and
+      // WebGPU requires storage buffer binding offsets to be a multiple of
+      // minStorageBufferOffsetAlignment, which is at most 256.
+      auto &Region = *reinterpret_cast<DeviceRegion *>(Data);
+      if (!Memory.lookup(*static_cast<void **>(Args[i]), Region) ||
+          Region.Offset % DeviceAllocAlignment) {
+        free(Copy);
+        return hipErrorInvalidValue;
+      }
+    } else {
+      memcpy(Data, Args[i], Kernel.ArgSizes[i]);
+    }
+    Data += (argSize(i) + 7) & ~7;
+  }
+  *ArgsCopy = Copy;
+  return hipSuccess;
 }
 
 hipError_t EMSCRIPTEN_KEEPALIVE hipLaunchKernel(const void *HostFunction,
                                                 dim3 GridDim, dim3 BlockDim,
                                                 void **Args, size_t SharedMem,
                                                 hipStream_t Stream) {
-  auto kernel = KernelNameMap[HostFunction];
-
-  hipError_t res = hipErrorUnknown;
-
-  w_queue.proxySyncWithCtx(emscripten_main_runtime_thread_id(), [&](auto ctx) {
-    wasm_hipLaunchKernel(emscripten_proxy_finish, ctx.ctx, &res, kernel,
-                         GridDim.x, GridDim.y, GridDim.z, BlockDim.x,
-                         BlockDim.y, BlockDim.z, Args, SharedMem,
-                         printfData.buffer);
-  });
-
-  auto printfSize = *(reinterpret_cast<const uint32_t *>(printfData.buffer));
-  if (*(reinterpret_cast<const uint32_t *>(printfData.buffer))) {
-    cvk_printf(printfData.buffer, printfData.bufferSize, printfData.map);
-  }
+  auto it = KernelMap.find(HostFunction);
+  if (it == KernelMap.end())
+    RETURN(hipErrorInvalidDeviceFunction);
+  const KernelInfo &Kernel = it->second;
 
-  if (res == hipErrorAssert) {
-    exit(1);
-  }
+  void **ArgsCopy;
+  if (hipError_t err = snapshotArgs(Kernel, Args, &ArgsCopy))
+    RETURN(err);
 
-  RETURN(res);
+  // Errors from the launch, including failed asserts, are reported by the
+  // next synchronization
+  Command C{Command::Launch, getStreamId(Stream)};
+  C.Args.Launch = {Kernel.Id,
+                   {GridDim.x, GridDim.y, GridDim.z},
+                   {BlockDim.x, BlockDim.y, BlockDim.z},
+                   ArgsCopy,
+                   SharedMem};
+  enqueueCommand(C);
+  return hipSuccess;
 }
 extern "C" void **EMSCRIPTEN_KEEPALIVE
 __hipRegisterFatBinary(const void *Data) {
@@ -317,7 +988,17 @@ extern "C" unsigned int EMSCRIPTEN_KEEPALIVE __hipRegisterFunction(
     void **Data, const void *HostFunction, char *DeviceFunction,
     const char *FuncDeviceName, unsigned int ThreadLimit, void *Tid, void *Bid,
     dim3 *BlockDim, dim3 *GridDim, int *WSize) {
-  KernelNameMap[HostFunction] = FuncDeviceName;
+  uint32_t ArgSizes[256];
+  uint8_t ArgIsBuffer[256];
+  uint32_t Id;
+  int Count =
+      wasm_hipKernelInfo(FuncDeviceName, ArgSizes, ArgIsBuffer, 256, &Id);
+  // not present in the device code, so it can never be launched
+  if (Count < 0)
+    return 0;
+  KernelMap[HostFunction] = {
+      Id, std::vector<uint32_t>(ArgSizes, ArgSizes + Count),
+      std::vector<bool>(ArgIsBuffer, ArgIsBuffer + Count)};
   return 0;
 }
 
@@ -343,8 +1024,9 @@ extern "C" void EMSCRIPTEN_KEEPALIVE __hipRegisterVar(
   bufferDesc.size = Size;
   bufferDesc.label = DeviceName;
   wgpu::Buffer buffer = device.CreateBuffer(&bufferDesc);
-  VariableBufferMap[Var] = buffer;
-  user_buffer_start = reinterpret_cast<uintptr_t>(buffer.Get());
+  VariableMap[Var] = {buffer, Memory.adopt(reinterpret_cast<uintptr_t>(
+                                               buffer.Get()),
+                                           Size)};
   wasm_hipRegisterVar(buffer.Get(), DeviceName, Size, Constant);
 }
 
@@ -0,0 +1,153 @@
+#include "memory.hpp"
+
+#include <algorithm>
+#include <iterator>
+
+static size_t alignUp(size_t Value, size_t Align) {
+  return (Value + Align - 1) / Align * Align;
+}
+
+size_t RangeAllocator::allocate(size_t Size, size_t Align) {
+  for (auto It = Free.begin(); It != Free.end(); ++It) {
+    size_t FreeStart = It->first, FreeEnd = It->first + It->second;
+    size_t Start = alignUp(FreeStart, Align);
+    if (Start >= FreeEnd || FreeEnd - Start < Size)
+      continue;
+    Free.erase(It);
+    if (Start > FreeStart)
+      Free.emplace(FreeStart, Start - FreeStart);
+    if (Start + Size < FreeEnd)
+      Free.emplace(Start + Size, FreeEnd - Start - Size);
+    return Start;
+  }
+  return Failed;
+}
+
+void RangeAllocator::release(size_t Offset, size_t Size) {
+  auto Next = Free.lower_bound(Offset);
+  if (Next != Free.end() && Offset + Size == Next->first) {
+    Size += Next->second;
+    Next = Free.erase(Next);
+  }
+  if (Next != Free.begin()) {
+    auto Prev = std::prev(Next);
+    if (Prev->first + Prev->second == Offset) {
+      Prev->second += Size;
+      return;
+    }
+  }
+  Free.emplace_hint(Next, Offset, Size);
+}
+
+DeviceMemory::Slab *DeviceMemory::addSlab(uint32_t Buffer, size_t Base,
+                                          size_t Size, bool Dedicated,
+                                          bool Freeable) {
+  Slabs.push_back(std::make_unique<Slab>(Slab{Buffer, AddressBase + Base, Size,
+                                              RangeAllocator(Size), Dedicated,
+                                              Freeable}));
+  return Slabs.back().get();
+}
+
+void *DeviceMemory::allocate(size_t Size, const CreateBufferFn &Create) {
+  // Storage buffer bindings must be a multiple of 4 bytes
+  Size = alignUp(std::max<size_t>(Size, 4), 4);
+
+  // Allocations too large to share a slab get a buffer of their own
+  constexpr size_t MaxSlabSize = 64 << 20;
+  bool Dedicated = Size > MaxSlabSize / 4;
+  size_t SlabSize, Base;
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+    if (!Dedicated) {
+      for (auto &S : Slabs) {
+        if (S->Dedicated)
+          continue;
+        size_t Offset = S->Space.allocate(Size, DeviceAllocAlignment);
+        if (Offset == RangeAllocator::Failed)
+          continue;
+        Allocations.emplace(S->Base + Offset, Allocation{S.get(), Size});
+        return reinterpret_cast<void *>(S->Base + Offset);
+      }
+    }
+
+    if (Dedicated) {
+      SlabSize = alignUp(Size, DeviceAllocAlignment);
+    } else {
+      // Slabs start small and grow, so programs with little device memory
+      // don't pay for a large buffer
+      SlabSize = NextSlabSize;
+      while (SlabSize < Size)
+        SlabSize *= 2;
+      NextSlabSize = std::min(SlabSize * 2, MaxSlabSize);
+    }
+    Base = Addresses.allocate(SlabSize, DeviceAllocAlignment);
+    if (Base == RangeAllocator::Failed)
+      return nullptr;
+  }
+
+  // Creating the buffer waits for the main thread, which may itself be
+  // waiting for Lock to finish a release, so it's done without holding it
+  uint32_t Buffer = Create(SlabSize);
+  std::lock_guard<std::mutex> Guard(Lock);
+  if (!Buffer) {
+    Addresses.release(Base, SlabSize);
+    return nullptr;
+  }
+  Slab *S = addSlab(Buffer, Base, SlabSize, Dedicated, true);
+  size_t Offset = Dedicated ? 0 : S->Space.allocate(Size, DeviceAllocAlignment);
+  Allocations.emplace(S->Base + Offset, Allocation{S, Size});
+  return reinterpret_cast<void *>(S->Base + Offset);
+}
+
+void *DeviceMemory::adopt(uint32_t Buffer, size_t Size) {
+  std::lock_guard<std::mutex> Guard(Lock);
+  Size = alignUp(std::max<size_t>(Size, 4), 4);
+  size_t Base = Addresses.allocate(Size, DeviceAllocAlignment);
+  if (Base == RangeAllocator::Failed)
+    return nullptr;
+  Slab *S = addSlab(Buffer, Base, Size, true, false);
+  Allocations.emplace(S->Base, Allocation{S, S->Size});
+  return reinterpret_cast<void *>(S->Base);
+}
+
+bool DeviceMemory::beginRelease(void *Ptr, uint32_t *DestroyBuffer) {
+  std::lock_guard<std::mutex> Guard(Lock);
+  auto It = Allocations.find(reinterpret_cast<uintptr_t>(Ptr));
+  if (It == Allocations.end() || !It->second.Owner->Freeable)
+    return false;
+  *DestroyBuffer = It->second.Owner->Dedicated ? It->second.Owner->Buffer : 0;
+  Releasing.insert(*It);
+  Allocations.erase(It);
+  return true;
+}
+
+void DeviceMemory::finishRelease(void *Ptr) {
+  std::lock_guard<std::mutex> Guard(Lock);
+  auto It = Releasing.find(reinterpret_cast<uintptr_t>(Ptr));
+  if (It == Releasing.end())
+    return;
+  Slab *S = It->second.Owner;
+  if (S->Dedicated) {
+    Addresses.release(S->Base - AddressBase, S->Size);
+    Slabs.erase(std::find_if(Slabs.begin(), Slabs.end(),
+                             [&](auto &Other) { return Other.get() == S; }));
+  } else {
+    S->Space.release(It->first - S->Base, It->second.Size);
+  }
+  Releasing.erase(It);
+}
+
+bool DeviceMemory::lookup(const void *Ptr, DeviceRegion &Region) {
+  uintptr_t Address = reinterpret_cast<uintptr_t>(Ptr);
+  std::lock_guard<std::mutex> Guard(Lock);
+  auto It = Allocations.upper_bound(Address);
+  if (It == Allocations.begin())
+    return false;
+  --It;
+  if (Address >= It->first + It->second.Size)
+    return false;
+  Region.Buffer = It->second.Owner->Buffer;
+  Region.Offset = Address - It->second.Owner->Base;
+  Region.Size = It->first + It->second.Size - Address;
+  return true;
+}
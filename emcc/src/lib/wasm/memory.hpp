@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Device pointers returned by hipMalloc are addresses in a virtual device
+// address space. Each backing WebGPU buffer (a slab) owns a range of that
+// space and allocations are carved out of slabs, so small allocations don't
+// each need their own buffer, and any address inside an allocation (e.g.
+// d_ptr + n) can be translated back to a buffer and offset.
+
+// Alignment of every allocation. This is the largest value WebGPU allows for
+// minStorageBufferOffsetAlignment, so allocations can always be bound.
+constexpr size_t DeviceAllocAlignment = 256;
+
+// Where an address lives
+struct DeviceRegion {
+  uint32_t Buffer; // WebGPU.mgrBuffer id
+  uint32_t Offset; // of the address within the buffer
+  uint32_t Size;   // bytes from the address to the end of its allocation
+};
+
+// First-fit allocator over [0, Size) that coalesces released ranges
+class RangeAllocator {
+public:
+  static constexpr size_t Failed = SIZE_MAX;
+
+  explicit RangeAllocator(size_t Size) { Free.emplace(0, Size); }
+  size_t allocate(size_t Size, size_t Align);
+  void release(size_t Offset, size_t Size);
+
+private:
+  // offset -> size
+  std::map<size_t, size_t> Free;
+};
+
+class DeviceMemory {
+public:
+  // Creates a buffer of the given size, returning its id or 0 on failure
+  using CreateBufferFn = std::function<uint32_t(size_t)>;
+
+  void *allocate(size_t Size, const CreateBufferFn &Create);
+  // Make an existing buffer addressable, e.g. for a global variable. It can't
+  // be freed.
+  void *adopt(uint32_t Buffer, size_t Size);
+  // Remove an allocation so it can no longer be used. Its memory stays
+  // reserved until finishRelease, once work queued before the free is done.
+  // If the allocation had a buffer to itself, *DestroyBuffer is set to it.
+  bool beginRelease(void *Ptr, uint32_t *DestroyBuffer);
+  void finishRelease(void *Ptr);
+  bool lookup(const void *Ptr, DeviceRegion &Region);
+
+private:
+  struct Slab {
+    uint32_t Buffer;
+    uintptr_t Base;
+    size_t Size;
+    RangeAllocator Space;
+    // Holds a single allocation and goes away with it
+    bool Dedicated;
+    bool Freeable;
+  };
+  struct Allocation {
+    Slab *Owner;
+    size_t Size;
+  };
+
+  // Base is the slab's range, already reserved from Addresses
+  Slab *addSlab(uint32_t Buffer, size_t Base, size_t Size, bool Dedicated,
+                bool Freeable);
+
+  std::mutex Lock;
+  std::vector<std::unique_ptr<Slab>> Slabs;
+  // by address
+  std::map<uintptr_t, Allocation> Allocations;
+  std::map<uintptr_t, Allocation> Releasing;
+  // Device pointers live in the top half of the address space. The heap is
+  // capped at 2 GiB (MAXIMUM_MEMORY), so however far it grows, no host pointer
+  // can be mistaken for a device pointer, and device pointers are never null.
+  static constexpr uintptr_t AddressBase = uintptr_t(1)
+                                           << (sizeof(uintptr_t) * 8 - 1);
+  RangeAllocator Addresses{SIZE_MAX - AddressBase};
+  size_t NextSlabSize = 4 << 20;
+};
@@ -14,7 +14,10 @@
 
 #include <hip/hip_fp16.h>
 #include <hip/hip_runtime.h>
-#include <sstream>
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstdio>
 
 #include "printf.hpp"
 
@@ -95,175 +98,244 @@ std::string get_vector_fmt(std::string fmt, int &vector_size, int &element_size,
   return fmt;
 }
 
-// Print the format part containing exactly one arg using snprintf
-std::string print_part(const std::string &fmt, const char *data, size_t size) {
-  // We don't know the exact size of the output string, but given we have a
-  // single argument, the size of the format string plus 1024 bytes is more
-  // than likely to fit everything. If it doesn't fit, just keep retrying with
-  // double the output size.
-  size_t out_size = fmt.size() + 1024;
-  std::vector<char> out(out_size);
-  out[0] = '\0';
-
-  auto conversion = std::tolower(get_fmt_conversion(fmt));
-  bool finished = false;
-  while (!finished) {
-    int written = 0;
-    switch (conversion) {
-    case 's': {
-      written = snprintf(out.data(), out_size, fmt.c_str(), data);
-      break;
-    }
-    case 'f':
-    case 'e':
-    case 'g':
-    case 'a': {
-      if (size == 2)
-        written = snprintf(out.data(), out_size, fmt.c_str(),
-                           __half2float(read_buff<__half>(data)));
-      else if (size == 4)
-        written =
-            snprintf(out.data(), out_size, fmt.c_str(), read_buff<float>(data));
-      else
-        written = snprintf(out.data(), out_size, fmt.c_str(),
-                           read_buff<double>(data));
-      break;
-    }
-    default: {
-      if (size == 1)
-        written = snprintf(out.data(), out_size, fmt.c_str(),
-                           read_buff<uint8_t>(data));
-      else if (size == 2)
-        written = snprintf(out.data(), out_size, fmt.c_str(),
-                           read_buff<uint16_t>(data));
-      else if (size == 4)
-        written = snprintf(out.data(), out_size, fmt.c_str(),
-                           read_buff<uint32_t>(data));
-      else
-        written = snprintf(out.data(), out_size, fmt.c_str(),
-                           read_buff<uint64_t>(data));
-      break;
-    }
-    }
-
-    // Finish if the string fit in the output buffer or snprintf failed,
-    // otherwise double the output buffer and try again. If snprintf failed,
-    // set the output to an empty string.
+// Append a value formatted with a single conversion format to out, without
+// going through a temporary buffer
+template <typename T>
+void append_format(std::string &out, const std::string &fmt, T value) {
+  size_t start = out.size();
+  // Given a single argument, the size of the format string plus some room is
+  // more than likely to fit everything. If it doesn't, retry with the size
+  // snprintf asked for.
+  size_t avail = fmt.size() + 64;
+  for (;;) {
+    out.resize(start + avail);
+    int written = snprintf(&out[start], avail, fmt.c_str(), value);
     if (written < 0) {
-      out[0] = '\0';
-      finished = true;
-    } else if (written < static_cast<long>(out_size)) {
-      finished = true;
-    } else {
-      out_size *= 2;
-      out.resize(out_size);
+      out.resize(start);
+      return;
     }
+    if (static_cast<size_t>(written) < avail) {
+      out.resize(start + written);
+      return;
+    }
+    avail = written + 1;
   }
-
-  return std::string(out.data());
 }
 
-void process_printf(const char *&data, const printf_descriptor_map_t &descs,
-                    const char *data_end) {
-
-  uint32_t printf_id = read_inc_buff<uint32_t>(data);
-  auto &format_string = descs.at(printf_id).format_string;
+template <typename T> void append_int(std::string &out, T value) {
+  char buf[24];
+  auto result = std::to_chars(buf, buf + sizeof(buf), value);
+  out.append(buf, result.ptr);
+}
 
-  std::stringstream printf_out{};
+// Append one argument of the given size formatted by op to out
+void print_part(std::string &out, const printf_op &op, const char *data,
+                size_t size) {
+  switch (op.conversion) {
+  case 'f':
+  case 'e':
+  case 'g':
+  case 'a': {
+    if (size == 2)
+      append_format(out, op.text, __half2float(read_buff<__half>(data)));
+    else if (size == 4)
+      append_format(out, op.text, read_buff<float>(data));
+    else
+      append_format(out, op.text, read_buff<double>(data));
+    break;
+  }
+  default: {
+    if (op.plain_int && size == 4) {
+      if (op.conversion == 'u')
+        append_int(out, read_buff<uint32_t>(data));
+      else
+        append_int(out, read_buff<int32_t>(data));
+    } else if (op.plain_int && size == 8) {
+      if (op.conversion == 'u')
+        append_int(out, read_buff<uint64_t>(data));
+      else
+        append_int(out, read_buff<int64_t>(data));
+    } else if (size == 1)
+      append_format(out, op.text, read_buff<uint8_t>(data));
+    else if (size == 2)
+      append_format(out, op.text, read_buff<uint16_t>(data));
+    else if (size == 4)
+      append_format(out, op.text, read_buff<uint32_t>(data));
+    else
+      append_format(out, op.text, read_buff<uint64_t>(data));
+    break;
+  }
+  }
+}
 
-  // Firstly print the part of the format string up to the first '%' if any
-  // otherwise print the whole string as is and move the data pointer to the
-  // end.
-  size_t next_part = format_string.find_first_of('%');
-  if (next_part == std::string::npos) {
-    next_part = format_string.size();
-    // data = data_end;
+// Split a format part that starts with a conversion into the op for the
+// conversion and the literal text that follows it
+void compile_part(std::vector<printf_op> &program, const std::string &part,
+                  uint32_t arg_size) {
+  printf_op op{};
+  op.arg_size = arg_size;
+  std::string remaining;
+  int element_size = 0;
+  op.text = get_vector_fmt(part, op.vector_size, element_size, remaining);
+  op.element_size = element_size;
+  if (op.vector_size < 2) {
+    auto conversion_pos = op.text.find_first_of("diouxXfFeEgGaAcsp");
+    remaining = op.text.substr(conversion_pos + 1);
+    op.text.resize(conversion_pos + 1);
   }
-  printf_out << format_string.substr(0, next_part);
+  op.conversion = std::tolower(get_fmt_conversion(op.text));
+  if (op.vector_size >= 2) {
+    op.kind = printf_op::vector;
+    // Without a length modifier, the element size is undefined behavior, so
+    // use the size coming from clspv
+    if (op.element_size == 0)
+      op.element_size = arg_size / op.vector_size;
+  } else {
+    op.kind = op.conversion == 's' ? printf_op::string : printf_op::scalar;
+    static const char *const plain_ints[] = {"%d",  "%i",  "%u",  "%ld",
+                                             "%li", "%lu", "%lld", "%lli",
+                                             "%llu"};
+    for (const char *plain : plain_ints)
+      op.plain_int |= op.text == plain;
+  }
+  program.push_back(std::move(op));
+  if (!remaining.empty())
+    program.push_back({printf_op::literal, 0, false, 0, 0, 0, remaining});
+}
 
-  // Decompose the remaining format string into individual strings with
-  // one format specifier each, handle each one individually
+void compile_printf(printf_descriptor &desc) {
+  std::string_view format_string = desc.format_string;
+  auto &program = desc.program;
+  program.clear();
+  auto literal = [&](std::string_view text) {
+    if (!text.empty())
+      program.push_back(
+          {printf_op::literal, 0, false, 0, 0, 0, std::string(text)});
+  };
+
+  // The part of the format string up to the first '%' if any, otherwise the
+  // whole string
+  size_t next_part = std::min(format_string.find_first_of('%'),
+                              format_string.size());
+  literal(format_string.substr(0, next_part));
+
+  // Decompose the remaining format string into parts with one format
+  // specifier each
   size_t arg_idx = 0;
   while (next_part < format_string.size()) {
-    // Get the part of the format string before the next format specifier
     size_t part_start = next_part;
     size_t part_end = format_string.find_first_of('%', part_start + 1);
-    auto part_fmt = format_string.substr(part_start, part_end - part_start);
+    std::string part_fmt(
+        format_string.substr(part_start, part_end - part_start));
 
-    // Handle special cases
     if (part_end == part_start + 1) {
-      printf_out << "%";
-      // We also need to print the literals between '%%' and the next '%'
+      // '%%', followed by the literals up to the next '%'
       next_part = part_start = part_end + 1;
       part_end = format_string.find_first_of('%', part_start);
-      if (part_end != std::string::npos && part_end > part_start) {
-        part_fmt = format_string.substr(part_start, part_end - part_start);
-        printf_out << part_fmt;
-        next_part = part_end;
-      }
+      literal("%" + std::string(format_string.substr(part_start,
+                                                     part_end - part_start)));
+      next_part = std::min(part_end, format_string.size());
       continue;
-    } else if (part_end == std::string::npos &&
-               arg_idx >= descs.at(printf_id).arg_sizes.size()) {
-      // If there are no remaining arguments, the rest of the format
-      // should be printed verbatim
-      printf_out << part_fmt;
+    }
+    if (arg_idx >= desc.num_args) {
+      // If there are no remaining arguments, the rest of the format should be
+      // printed verbatim
+      literal(format_string.substr(part_start));
       break;
     }
 
-    // The size of the argument that this format part will consume
-    auto &size = descs.at(printf_id).arg_sizes[arg_idx];
+    compile_part(program, part_fmt, desc.arg_sizes[arg_idx]);
+    next_part = part_end;
+    arg_idx++;
+  }
+}
+
+bool printf_table::load(std::vector<uint32_t> words) {
+  const size_t header_words = 2, entry_words = sizeof(entry) / 4;
+  if (words.size() < header_words || words[0] != magic ||
+      (words.size() - header_words) / entry_words < words[1])
+    return false;
+  data = std::move(words);
+  entries = reinterpret_cast<const entry *>(data.data() + header_words);
+  count = data[1];
+  descriptors.clear();
+  return true;
+}
+
+const printf_descriptor *printf_table::find(uint32_t id) {
+  auto it = descriptors.find(id);
+  if (it != descriptors.end())
+    return &it->second;
+
+  const entry *e = std::lower_bound(
+      entries, entries + count, id,
+      [](const entry &other, uint32_t id) { return other.id < id; });
+  size_t size = data.size() * sizeof(uint32_t);
+  if (e == entries + count || e->id != id ||
+      e->format_offset + size_t(e->format_size) >= size ||
+      e->args_offset + size_t(e->num_args) * 4 > size)
+    return nullptr;
+
+  const char *base = reinterpret_cast<const char *>(data.data());
+  printf_descriptor desc;
+  desc.format_string = {base + e->format_offset, e->format_size};
+  desc.arg_sizes = reinterpret_cast<const uint32_t *>(base + e->args_offset);
+  desc.num_args = e->num_args;
+  compile_printf(desc);
+  return &descriptors.emplace(id, std::move(desc)).first->second;
+}
 
+// Append one printf record to out, advancing data past it. A record that was
+// cut short by the end of the buffer is dropped.
+void process_printf(std::string &out, const char *&data, printf_table &table,
+                    const char *data_end) {
+  uint32_t printf_id = read_inc_buff<uint32_t>(data);
+  const printf_descriptor *desc = table.find(printf_id);
+  if (!desc) {
+    // The size of the record is unknown, so nothing after it can be read
+    data = data_end;
+    return;
+  }
+  size_t record_start = out.size();
+
+  for (const auto &op : desc->program) {
+    if (op.kind == printf_op::literal) {
+      out += op.text;
+      continue;
+    }
+    size_t size = op.arg_size;
     if (data + size > data_end) {
       data += size;
+      out.resize(record_start);
       return;
     }
 
-    // Check to see if we have a vector format specifier
-    int vec_len = 0;
-    int el_size = 0;
-    std::string remaining_str;
-    part_fmt = get_vector_fmt(part_fmt, vec_len, el_size, remaining_str);
-
-    // Scalar argument
-    if (vec_len < 2) {
-      // Special case for %s
-      if (get_fmt_conversion(part_fmt) == 's') {
-        uint32_t string_id = read_buff<uint32_t>(data);
-        printf_out << print_part(
-            part_fmt, descs.at(string_id).format_string.c_str(), size);
-      } else {
-        printf_out << print_part(part_fmt, data, size);
-      }
-      data += size;
-    } else {
-      // Vector argument
-      if (el_size == 0) {
-        // 'ele_size == 0' means that no length modifier has been used.
-        // According to the spec, this is an undefined behavior. Let's
-        // use the size coming from clspv and the vec_len to figure out
-        // the element size then.
-        el_size = size / vec_len;
-      }
-      auto *data_start = data;
-      for (int i = 0; i < vec_len - 1; i++) {
-        printf_out << print_part(part_fmt, data, size / vec_len) << ",";
-        data += el_size;
+    switch (op.kind) {
+    case printf_op::string: {
+      uint32_t string_id = read_buff<uint32_t>(data);
+      const printf_descriptor *string = table.find(string_id);
+      append_format(out, op.text,
+                    string ? string->format_string.data() : "(null)");
+      break;
+    }
+    case printf_op::vector: {
+      size_t element_size = size / op.vector_size;
+      for (int i = 0; i < op.vector_size; i++) {
+        if (i)
+          out += ',';
+        print_part(out, op, data + i * op.element_size, element_size);
       }
-      printf_out << print_part(part_fmt, data, size / vec_len) << remaining_str;
-      data = data_start + size;
+      break;
     }
-
-    // Move to the next format part and prepare to handle the next arg
-    next_part = part_end;
-    arg_idx++;
+    default:
+      print_part(out, op, data, size);
+      break;
+    }
+    data += size;
   }
-
-  auto output = printf_out.str();
-  printf("%s", output.c_str());
 }
 
-void cvk_printf(const char *data, size_t buffer_size,
-                const printf_descriptor_map_t &descriptors) {
+void cvk_printf(const char *data, size_t buffer_size, printf_table &table) {
   assert(data);
   const auto bytes_written_size = sizeof(uint32_t);
   const size_t data_size = buffer_size - bytes_written_size;
@@ -271,9 +343,13 @@ void cvk_printf(const char *data, size_t buffer_size,
   const size_t limit = std::min(bytes_written, data_size);
   auto *data_end = data + limit;
 
+  // Everything is formatted into one buffer and written at once
+  static std::string out;
+  out.clear();
   while (data < data_end) {
-    process_printf(data, descriptors, data_end);
+    process_printf(out, data, table, data_end);
   }
+  fwrite(out.data(), 1, out.size(), stdout);
 
   if (buffer_size < bytes_written) {
     fprintf(stderr,
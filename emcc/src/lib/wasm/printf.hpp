@@ -17,16 +17,72 @@
 // #include "context.hpp"
 // #include "memory.hpp"
 
+#include <cstdint>
+#include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
+// One step of a compiled format string
+struct printf_op {
+  enum kind_t : uint8_t {
+    literal, // text is printed as is
+    scalar,  // text is a format with a single conversion
+    string,  // as scalar, for a %s whose argument is a string id
+    vector,  // as scalar, applied to each element and joined with ','
+  } kind;
+  // Lower case conversion specifier
+  char conversion;
+  // Integer conversion that can be written without snprintf, when the format
+  // is just the conversion
+  bool plain_int;
+  int vector_size;
+  uint32_t element_size;
+  // Bytes the argument takes in the printf buffer
+  uint32_t arg_size;
+  std::string text;
+};
+
 struct printf_descriptor {
-  std::string format_string;
-  std::vector<uint32_t> arg_sizes;
+  // Points into the printf table, which keeps it NUL-terminated
+  std::string_view format_string;
+  const uint32_t *arg_sizes;
+  uint32_t num_args;
+  // format_string split into ops by compile_printf
+  std::vector<printf_op> program;
+};
+
+// The binary printf table written by clspv-reflection --printf-table. It is
+// used where it was loaded, and descriptors are only built for the printfs
+// that actually run.
+class printf_table {
+public:
+  // Take the table contents; returns false if they aren't a valid table
+  bool load(std::vector<uint32_t> words);
+  // The descriptor with the given id, compiled on first use, or null if there
+  // is none
+  const printf_descriptor *find(uint32_t id);
+
+private:
+  struct entry {
+    uint32_t id;
+    uint32_t format_offset;
+    uint32_t format_size;
+    uint32_t args_offset;
+    uint32_t num_args;
+  };
+  static constexpr uint32_t magic = 0x66747270; // 'prtf'
+
+  std::vector<uint32_t> data;
+  const entry *entries = nullptr;
+  uint32_t count = 0;
+  std::unordered_map<uint32_t, printf_descriptor> descriptors;
 };
 
-using printf_descriptor_map_t = std::unordered_map<uint32_t, printf_descriptor>;
+// Parse the format string of a descriptor into its program. This must be done
+// before its records are printed.
+void compile_printf(printf_descriptor &descriptor);
 
 // Process the contents of the printf buffer and print the results to stdout
 void cvk_printf(const char *printf_buffer, size_t buffer_size,
-                const printf_descriptor_map_t &descriptors);
+                printf_table &table);
@@ -26,194 +26,676 @@ function asyncify(errs, f) {
 }
 
 addToLibrary({
-	wasm_hipLaunchKernel: asyncify(
-		['validation'],
-		async (
-			/** @type {number} */ kernelPtr,
-			/** @type {number} */ gx,
-			/** @type {number} */ gy,
-			/** @type {number} */ gz,
-			/** @type {number} */ bx,
-			/** @type {number} */ by,
-			/** @type {number} */ bz,
-			/** @type {number} */ Args,
-			/** @type {number} */ SharedMem,
-			/** @type {number} */ printfBuffer
-		) => {
-			const device = window.wgpuDevice;
-			const kernelName = UTF8ToString(kernelPtr);
-			const kernel = Module.wgpuKernelMap.get(kernelName);
-			if (!kernel) return 98; // hipErrorInvalidDeviceFunction
-			if (!kernel.bindGroupLayout) {
-				for (const { arg, binding } of kernel.args) {
-					if (arg.startsWith('_chip_var_')) {
-						kernel.bindGroupLayoutDesc.push({
-							binding: +binding,
-							visibility: GPUShaderStage.COMPUTE,
-							buffer: {
-								type: 'storage' // Module.wgpuGlobals[arg].constant ? "uniform" : "storage",
-							}
-						});
+	$wgpuStream(/** @type {number} */ id) {
+		let stream = Module.wgpuStreams.get(id);
+		if (!stream) {
+			stream = { tail: Promise.resolve(), error: 0, nonBlocking: false };
+			Module.wgpuStreams.set(id, stream);
+		}
+		return stream;
+	},
+	/**
+	 * Append an operation to a stream's command list. Operations on one stream
+	 * run in order. Following the legacy default stream semantics, the null
+	 * stream (0) waits for every blocking stream, and blocking streams wait for
+	 * the null stream. Resolves with the operation's hipError_t; unless the
+	 * caller is waiting on that result, a failure is kept on the stream and
+	 * returned by the next synchronization.
+	 */
+	$wgpuEnqueue__deps: ['$wgpuStream'],
+	$wgpuEnqueue(
+		/** @type {number} */ id,
+		/** @type {() => Promise<number | void>} */ op,
+		/** @type {boolean} */ sticky
+	) {
+		const stream = wgpuStream(id);
+		const deps = [stream.tail];
+		for (const [otherId, other] of Module.wgpuStreams) {
+			if (other === stream || other.nonBlocking || stream.nonBlocking) continue;
+			if (id === 0 || otherId === 0) deps.push(other.tail);
+		}
+		const result = Promise.all(deps)
+			.then(op)
+			.then(
+				(res) => res || 0,
+				(e) => {
+					err(e.message || e.toString());
+					return 1;
+				}
+			);
+		stream.tail = result.then((res) => {
+			if (sticky && res && !stream.error) stream.error = res;
+		});
+		return result;
+	},
+	/**
+	 * Consecutive work on one stream is recorded into a single command encoder
+	 * (and, without timestamp queries, a single compute pass) and submitted
+	 * together. The batch is only submitted early at host-visible boundaries
+	 * such as readbacks and synchronization, when another stream records work,
+	 * or once it has grown large. Otherwise it is submitted as soon as the main
+	 * thread goes idle, so the GPU always makes progress.
+	 */
+	$wgpuBatch__deps: ['$wgpuFlush'],
+	$wgpuBatch(/** @type {number} */ stream) {
+		if (Module.wgpuBatch?.stream === stream) return Module.wgpuBatch;
+		wgpuFlush();
+		const batch = {
+			stream,
+			encoder: window.wgpuDevice.createCommandEncoder(),
+			/** @type {GPUComputePassEncoder | null} */
+			pass: null,
+			dispatches: 0,
+			/** @type {any[]} */
+			kernels: [],
+			/** @type {any[]} */
+			readbacks: [],
+			/** @type {GPUBuffer[]} uploads to destroy once the batch has executed */
+			staging: [],
+			/** @type {any[]} uniform arena allocations the batch reads */
+			uniforms: []
+		};
+		Module.wgpuBatch = batch;
+		setTimeout(() => Module.wgpuBatch === batch && wgpuFlush());
+		return batch;
+	},
+	/** Get a compute pass to record into, starting a new one if `descriptor` is given */
+	$wgpuComputePass__deps: ['$wgpuEndPass'],
+	$wgpuComputePass(
+		/** @type {any} */ batch,
+		/** @type {GPUComputePassDescriptor | undefined} */ descriptor
+	) {
+		if (batch.pass && !descriptor) return batch.pass;
+		wgpuEndPass(batch);
+		batch.pass = batch.encoder.beginComputePass(descriptor);
+		return batch.pass;
+	},
+	$wgpuEndPass(/** @type {any} */ batch) {
+		batch.pass?.end();
+		batch.pass = null;
+	},
+	/**
+	 * Submit the open batch, if any. Resolves with the hipError_t of the
+	 * submission, which is also kept on the stream that recorded it.
+	 */
+	$wgpuFlush__deps: ['$wgpuEndPass', '$wgpuStream', '$wgpuReleaseStaging', '$wgpuDrainPrintf'],
+	$wgpuFlush__postset: 'Module.wgpuFlush = wgpuFlush;',
+	$wgpuFlush() {
+		const batch = Module.wgpuBatch;
+		if (!batch) return Promise.resolve(0);
+		Module.wgpuBatch = null;
+		const device = window.wgpuDevice;
+		if (batch.printf) wgpuDrainPrintf(batch);
+		wgpuEndPass(batch);
+		device.pushErrorScope('validation');
+		device.queue.submit([batch.encoder.finish()]);
+		if (batch.uniforms.length || batch.staging.length) {
+			device.queue.onSubmittedWorkDone().then(() => {
+				for (const alloc of batch.uniforms) alloc.done = true;
+				// Space is recycled in allocation order, up to the first allocation
+				// whose batch hasn't executed. That may not be recorded yet: another
+				// launch can allocate and only record once it has been scheduled.
+				const arena = Module.wgpuUniformArena;
+				while (arena?.pending[0]?.done) arena.released = arena.pending.shift().end;
+				// destroying a buffer before the submission that uses it is a
+				// validation error for the whole batch
+				for (const staging of batch.staging) staging.destroy();
+			});
+		}
+		const result = device.popErrorScope().then((error) => {
+			if (!error) return 0;
+			err(error.message);
+			for (const kernelRan of batch.kernels) kernelRan.status = error.message;
+			const stream = wgpuStream(batch.stream);
+			stream.error ||= 1;
+			return 1;
+		});
+		// one mapAsync for all the readbacks sharing a staging buffer
+		for (const readback of batch.readbacks) {
+			readback.buffer.mapAsync(GPUMapMode.READ).then(
+				async () => {
+					const res = await result;
+					const data = new Uint8Array(readback.buffer.getMappedRange(0, readback.used));
+					for (const copy of readback.copies) {
+						const copied = data.subarray(copy.offset, copy.offset + copy.size);
+						if (!res) {
+							if (typeof copy.dst === 'function') copy.dst(copied);
+							else HEAPU8.set(copied, copy.dst);
+						}
+						copy.resolve(res);
 					}
+					readback.buffer.unmap();
+					wgpuReleaseStaging(readback.buffer);
+				},
+				(/** @type {any} */ e) => {
+					err(e.message || e.toString());
+					for (const copy of readback.copies) copy.resolve(1);
+					readback.buffer.destroy();
 				}
-
-				kernel.bindGroupLayout = device.createBindGroupLayout({
-					entries: kernel.bindGroupLayoutDesc
-				});
-				kernel.pipelineLayout = device.createPipelineLayout({
-					bindGroupLayouts: [
-						kernel.bindGroupLayout,
-						// Module.wgpuPrintfGroupLayout
-						...(kernel.printf ? [Module.wgpuPrintfGroupLayout] : [])
-					]
-				});
-			}
-			/** @type GPUBindGroupEntry[] */
-			const bindGroups = [];
-			/** @type GPUBuffer[] */
-			const uniforms = kernel.uniformBuffers.map((size) =>
-				device.createBuffer({
-					size,
-					usage: GPUBufferUsage.UNIFORM, // | GPUBufferUsage.COPY_DST,
-					mappedAtCreation: true
-				})
 			);
-			uniforms.forEach((buffer, i) => {
-				bindGroups.push({ binding: i, resource: { buffer } });
+		}
+		return result;
+	},
+	/**
+	 * Copy out what the batch's kernels printed and reset the device buffer for
+	 * the next batch. The buffer is snapshotted on the device and only the start
+	 * of the snapshot is read back with the batch; the rest is copied out
+	 * afterwards if the counter says it was written. The output is printed, in
+	 * batch order, once it has been read back; synchronization waits for that.
+	 */
+	$wgpuDrainPrintf__deps: ['$wgpuEndPass', '$wgpuReadback', '$wgpuAcquireStaging', '$wgpuReleaseStaging', 'malloc', 'free', 'wasm_printfDrain'],
+	$wgpuDrainPrintf(/** @type {any} */ batch) {
+		const device = window.wgpuDevice;
+		const printfBuffer = Module.wgpuPrintfBuffer;
+		const snapshot =
+			Module.wgpuPrintfSnapshots?.pop() ??
+			device.createBuffer({
+				size: printfBuffer.size,
+				usage: GPUBufferUsage.COPY_SRC | GPUBufferUsage.COPY_DST
 			});
-			const uniformRanges = uniforms.map((uniform) => new Uint8Array(uniform.getMappedRange()));
-			/** @type false | GPUBuffer */
-			let abortBuffer = false;
-			for (const { arg, argOrdinal, argKind, binding, argSize, offset } of kernel.args) {
+		wgpuEndPass(batch);
+		batch.encoder.copyBufferToBuffer(printfBuffer, 0, snapshot, 0, printfBuffer.size);
+		batch.encoder.clearBuffer(printfBuffer, 0, 4);
+		let head = new Uint8Array();
+		const output = wgpuReadback(
+			batch,
+			snapshot,
+			0,
+			(/** @type {Uint8Array} */ data) => (head = data.slice()),
+			4096
+		).then(async (res) => {
+			if (res) return head;
+			// the counter is in words, and keeps counting past the end of the buffer
+			const used = Math.min(new Uint32Array(head.buffer, 0, 1)[0] * 4 + 4, snapshot.size);
+			if (used <= head.length) return head.subarray(0, used);
+			const staging = wgpuAcquireStaging(used);
+			const encoder = device.createCommandEncoder();
+			encoder.copyBufferToBuffer(snapshot, 0, staging, 0, used);
+			device.queue.submit([encoder.finish()]);
+			try {
+				await staging.mapAsync(GPUMapMode.READ, 0, used);
+			} catch (/** @type {any} */ e) {
+				err(e.message || e.toString());
+				staging.destroy();
+				return new Uint8Array();
+			}
+			const data = new Uint8Array(staging.getMappedRange(0, used)).slice();
+			staging.unmap();
+			wgpuReleaseStaging(staging);
+			return data;
+		});
+		Module.wgpuPendingReadbacks ??= new Set();
+		const pending = Promise.all([output, Module.wgpuPrintfOutput]).then(([data]) => {
+			(Module.wgpuPrintfSnapshots ??= []).push(snapshot);
+			if (!data.length) return;
+			const ptr = _malloc(data.length);
+			HEAPU8.set(data, ptr);
+			_wasm_printfDrain(ptr, printfBuffer.size);
+			_free(ptr);
+		});
+		Module.wgpuPrintfOutput = pending;
+		pending.then(() => Module.wgpuPendingReadbacks.delete(pending));
+		Module.wgpuPendingReadbacks.add(pending);
+	},
+	/**
+	 * Staging buffers for device-to-host copies are pooled by power-of-two
+	 * size, so repeated readbacks reuse them instead of creating a buffer each.
+	 */
+	$wgpuAcquireStaging(/** @type {number} */ size) {
+		const bucket = Math.max(2 ** Math.ceil(Math.log2(size)), 65536);
+		const free = Module.wgpuStagingPool?.get(bucket);
+		if (free?.length) return free.pop();
+		return window.wgpuDevice.createBuffer({
+			size: bucket,
+			usage: GPUBufferUsage.COPY_DST | GPUBufferUsage.MAP_READ
+		});
+	},
+	$wgpuReleaseStaging(/** @type {GPUBuffer} */ buffer) {
+		Module.wgpuStagingPool ??= new Map();
+		let free = Module.wgpuStagingPool.get(buffer.size);
+		if (!free) Module.wgpuStagingPool.set(buffer.size, (free = []));
+		// a few of each size cover repeated readbacks without holding on to much
+		if (free.length < 4) free.push(buffer);
+		else buffer.destroy();
+	},
+	/**
+	 * Record a copy from `src` into host memory at `dst`, resolving with a
+	 * hipError_t once the batch has executed and the data has been written.
+	 * `dst` may instead be a function that is passed the data while it is
+	 * mapped. Small copies in a batch share a staging buffer and are mapped
+	 * together.
+	 */
+	$wgpuReadback__deps: ['$wgpuAcquireStaging', '$wgpuEndPass'],
+	$wgpuReadback(
+		/** @type {any} */ batch,
+		/** @type {GPUBuffer} */ src,
+		/** @type {number} */ srcOffset,
+		/** @type {number | ((data: Uint8Array) => void)} */ dst,
+		/** @type {number} */ size
+	) {
+		const shared = size <= 16384;
+		let readback = shared
+			? batch.readbacks.find(
+					(/** @type {any} */ r) => r.shared && r.used + size <= r.buffer.size
+				)
+			: undefined;
+		if (!readback) {
+			readback = { buffer: wgpuAcquireStaging(size), used: 0, shared, copies: [] };
+			batch.readbacks.push(readback);
+		}
+		const offset = readback.used;
+		readback.used += (size + 3) & ~3;
+		wgpuEndPass(batch);
+		batch.encoder.copyBufferToBuffer(src, srcOffset, readback.buffer, offset, size);
+		return new Promise((resolve) => readback.copies.push({ offset, dst, size, resolve }));
+	},
+	/**
+	 * Kernel POD arguments live in one ring-allocated uniform buffer, bound with
+	 * dynamic offsets. Space is handed out at minUniformBufferOffsetAlignment
+	 * and recycled once the batches that read it have executed; each batch lists
+	 * its allocations. Offsets are counted monotonically and wrapped into the
+	 * buffer.
+	 */
+	$wgpuUniformArena() {
+		if (!Module.wgpuUniformArena) {
+			const size = 1048576;
+			Module.wgpuUniformArena = {
+				buffer: window.wgpuDevice.createBuffer({
+					size,
+					usage: GPUBufferUsage.UNIFORM | GPUBufferUsage.COPY_DST
+				}),
+				size,
+				head: 0,
+				released: 0,
+				/** @type {any[]} allocations not yet known to be free, in order */
+				pending: []
+			};
+		}
+		return Module.wgpuUniformArena;
+	},
+	/**
+	 * Reserve `size` bytes of the uniform arena. Resolves with the allocation,
+	 * which the caller adds to the `uniforms` of the batch it records into.
+	 */
+	$wgpuUniformAlloc__deps: ['$wgpuUniformArena', '$wgpuFlush'],
+	async $wgpuUniformAlloc(/** @type {number} */ size) {
+		const device = window.wgpuDevice;
+		const arena = wgpuUniformArena();
+		const align = device.limits.minUniformBufferOffsetAlignment;
+		size = Math.ceil(size / align) * align;
+		for (;;) {
+			let start = arena.head;
+			// allocations don't wrap around the end of the buffer
+			const offset = start % arena.size;
+			if (offset + size > arena.size) start += arena.size - offset;
+			if (start + size - arena.released <= arena.size) {
+				arena.head = start + size;
+				const alloc = { offset: start % arena.size, end: arena.head, done: false };
+				arena.pending.push(alloc);
+				return alloc;
+			}
+			// The whole ring is still in flight; wait for the batches using it
+			await wgpuFlush();
+			await device.queue.onSubmittedWorkDone();
+		}
+	},
+	/**
+	 * Remember a kernel's bind group for a set of buffer arguments, indexed by
+	 * each buffer so that it can be dropped when the buffer is freed.
+	 */
+	$wgpuCacheBindGroup(
+		/** @type {Map<string, GPUBindGroup>} */ cache,
+		/** @type {string} */ key,
+		/** @type {number[]} */ bufferIds,
+		/** @type {GPUBindGroup} */ bindGroup
+	) {
+		cache.set(key, bindGroup);
+		Module.wgpuBindGroupsByBuffer ??= new Map();
+		for (const id of bufferIds) {
+			let uses = Module.wgpuBindGroupsByBuffer.get(id);
+			if (!uses) Module.wgpuBindGroupsByBuffer.set(id, (uses = []));
+			uses.push({ cache, key });
+		}
+	},
+	$wgpuForgetBuffer(/** @type {number} */ id) {
+		for (const { cache, key } of Module.wgpuBindGroupsByBuffer?.get(id) ?? []) cache.delete(key);
+		Module.wgpuBindGroupsByBuffer?.delete(id);
+	},
+	/** Wait for everything queued on `streams`, then return their first error */
+	$wgpuDrain__deps: ['$wgpuFlush', '$wgpuAbortStatus'],
+	async $wgpuDrain(/** @type {any[]} */ streams) {
+		await Promise.all(streams.map((stream) => stream.tail));
+		await wgpuFlush();
+		await window.wgpuDevice.queue.onSubmittedWorkDone();
+		await Promise.all(Module.wgpuPendingReadbacks ?? []);
+		let res = wgpuAbortStatus();
+		for (const stream of streams) {
+			res ||= stream.error;
+			stream.error = 0;
+		}
+		return res;
+	},
+	$wgpuLaunch__deps: ['free', '$wgpuUniformAlloc', '$wgpuCacheBindGroup', '$wgpuBatch', '$wgpuComputePass', '$wgpuEndPass', '$wgpuFlush', '$wgpuReadback'],
+	async $wgpuLaunch(
+		/** @type {number} */ stream,
+		/** @type {any} */ kernel,
+		/** @type {number} */ gx,
+		/** @type {number} */ gy,
+		/** @type {number} */ gz,
+		/** @type {number} */ bx,
+		/** @type {number} */ by,
+		/** @type {number} */ bz,
+		/** @type {number} */ Args,
+		/** @type {number} */ SharedMem
+	) {
+		const device = window.wgpuDevice;
+		if (!kernel.bindGroupLayout) {
+			for (const { arg, binding } of kernel.args) {
 				if (arg.startsWith('_chip_var_')) {
-					const buffer = Module.wgpuGlobals[arg].buffer;
-					if (arg === '_chip_var___chipspv_abort_called') abortBuffer = buffer;
-					bindGroups.push({
+					kernel.bindGroupLayoutDesc.push({
 						binding: +binding,
-						resource: { buffer }
+						visibility: GPUShaderStage.COMPUTE,
+						buffer: {
+							type: 'storage' // Module.wgpuGlobals[arg].constant ? "uniform" : "storage",
+						}
 					});
-					continue;
-				}
-				const argLoc = HEAPU32[Args / 4 + +argOrdinal];
-				if (argKind === 'buffer') {
-					const buffer = WebGPU.mgrBuffer.get(HEAPU32[argLoc / 4] / 8);
-					bindGroups.push({ binding: +binding, resource: { buffer } });
-				} else {
-					uniformRanges[+binding].set(HEAPU8.subarray(argLoc, argLoc + +argSize), +offset);
 				}
 			}
-			uniforms.forEach((uniform) => uniform.unmap());
-
-			// Create compute pipeline
-			const computePipeline = device.createComputePipeline({
-				layout: kernel.pipelineLayout,
-				compute: {
-					module: Module.wgpuShaderModule,
-					entryPoint: kernelName,
 
-					constants: {
-						_cuda_wgx: bx,
-						_cuda_wgy: by,
-						_cuda_wgz: bz,
-						...(kernel.dynamic_mem && {
-							_cuda_shared: Math.max((SharedMem / kernel.dynamic_mem) | 0, 1)
-						})
-					}
-				}
+			kernel.bindGroupLayout = device.createBindGroupLayout({
+				entries: kernel.bindGroupLayoutDesc
+			});
+			kernel.pipelineLayout = device.createPipelineLayout({
+				bindGroupLayouts: [
+					kernel.bindGroupLayout,
+					// Module.wgpuPrintfGroupLayout
+					...(kernel.printf ? [Module.wgpuPrintfGroupLayout] : [])
+				]
 			});
+		}
+		// Compiled asynchronously on the first launch with this configuration
+		let computePipeline;
+		try {
+			computePipeline = await Module.wgpuGetPipeline(
+				kernel,
+				bx,
+				by,
+				bz,
+				kernel.dynamic_mem ? Math.max((SharedMem / kernel.dynamic_mem) | 0, 1) : undefined
+			);
+			// one allocation for all of the kernel's uniform bindings
+			const align = device.limits.minUniformBufferOffsetAlignment;
+			/** @type number[] */
+			var uniformOffsets = [];
+			/** @type any */
+			var uniforms = null;
+			let uniformSize = 0;
+			kernel.uniformBuffers.forEach((/** @type number */ size) => {
+				uniformOffsets.push(uniformSize);
+				uniformSize += Math.ceil(size / align) * align;
+			});
+			if (uniformSize) {
+				uniforms = await wgpuUniformAlloc(uniformSize);
+				uniformOffsets = uniformOffsets.map((offset) => uniforms.offset + offset);
+			}
+		} catch (e) {
+			_free(Args);
+			throw e;
+		}
+
+		device.pushErrorScope('validation');
+		const arena = Module.wgpuUniformArena;
+		/** @type GPUBindGroupEntry[] */
+		const bindGroups = [];
+		/** @type Uint8Array[] */
+		const uniformRanges = [];
+		kernel.uniformBuffers.forEach((/** @type number */ size, /** @type number */ binding) => {
+			bindGroups.push({ binding, resource: { buffer: arena.buffer, size } });
+			uniformRanges[binding] = new Uint8Array(size);
+		});
+		/** @type false | GPUBuffer */
+		let abortBuffer = false;
+		/** @type number[] */
+		const bufferIds = [];
+		/** @type string[] */
+		const bufferRanges = [];
+		let cacheable = true;
+		for (const { global, abort, ordinal, isBuffer, binding, size, offset } of kernel.launchArgs) {
+			if (global) {
+				const buffer = Module.wgpuGlobals[global].buffer;
+				if (abort) abortBuffer = buffer;
+				bindGroups.push({ binding, resource: { buffer } });
+				continue;
+			}
+			const argLoc = HEAPU32[Args / 4 + ordinal];
+			if (isBuffer) {
+				// translated to a DeviceRegion when the launch was queued
+				const [id, offset, size] = HEAPU32.subarray(argLoc / 4, argLoc / 4 + 3);
+				const buffer = WebGPU.mgrBuffer.get(id);
+				if (!buffer) cacheable = false;
+				bufferIds.push(id);
+				bufferRanges.push(`${id}:${offset}:${size}`);
+				bindGroups.push({ binding, resource: { buffer, offset, size } });
+			} else {
+				uniformRanges[binding].set(HEAPU8.subarray(argLoc, argLoc + size), offset);
+			}
+		}
+		let i = 0;
+		uniformRanges.forEach((data) => {
+			device.queue.writeBuffer(arena.buffer, uniformOffsets[i++], data);
+		});
+		_free(Args);
 
-			// Create bind group
-			const bindGroup = device.createBindGroup({
+		// Everything but the buffer arguments is the same for every launch of a
+		// kernel, and POD arguments are selected with dynamic offsets
+		const bindGroupKey = bufferRanges.join(',');
+		kernel.bindGroups ??= new Map();
+		let bindGroup = kernel.bindGroups.get(bindGroupKey);
+		if (!bindGroup) {
+			bindGroup = device.createBindGroup({
 				layout: kernel.bindGroupLayout,
 				entries: bindGroups
 			});
+			if (cacheable) wgpuCacheBindGroup(kernel.bindGroups, bindGroupKey, bufferIds, bindGroup);
+		}
 
-			// Create command encoder
-			const commandEncoder = device.createCommandEncoder();
-			const timestamp = !!Module.wgpuTimestampQuery;
-			const passEncoder = commandEncoder.beginComputePass(
-				timestamp
-					? {
-							timestampWrites: {
-								querySet: Module.wgpuTimestampQuery,
-								beginningOfPassWriteIndex: 0,
-								endOfPassWriteIndex: 1
-							}
+		// The printf buffer is drained once per batch, so a kernel that prints
+		// gets all of it rather than sharing it with the batch's earlier ones
+		if (kernel.printf && Module.wgpuBatch?.printf) wgpuFlush();
+		const batch = wgpuBatch(stream);
+		if (uniforms) batch.uniforms.push(uniforms);
+		const commandEncoder = batch.encoder;
+		const timestamp = !!Module.wgpuTimestampQuery;
+		// timestamps are written per pass, so timed kernels each get their own
+		const passEncoder = wgpuComputePass(
+			batch,
+			timestamp
+				? {
+						timestampWrites: {
+							querySet: Module.wgpuTimestampQuery,
+							beginningOfPassWriteIndex: 0,
+							endOfPassWriteIndex: 1
 						}
-					: {}
-			);
-			passEncoder.setPipeline(computePipeline);
-			passEncoder.setBindGroup(0, bindGroup);
-			passEncoder.setBindGroup(Module.wgpuAnyKernelHasBindings ? 1 : 0, Module.wgpuPrintfBindGroup);
-			passEncoder.dispatchWorkgroups(gx, gy, gz);
-			passEncoder.end();
-
-			if (timestamp && Module.wgpuKernelsRan.length * 16 < Module.wgpuTimestampReadBuffer.size) {
-				commandEncoder.resolveQuerySet(
-					Module.wgpuTimestampQuery,
-					0,
-					2,
-					Module.wgpuTimestampBuffer,
-					0
-				);
-				commandEncoder.copyBufferToBuffer(
-					Module.wgpuTimestampBuffer,
-					0,
-					Module.wgpuTimestampReadBuffer,
-					Module.wgpuKernelsRan.length * 16,
-					16
-				);
-			}
+					}
+				: undefined
+		);
+		passEncoder.setPipeline(computePipeline);
+		passEncoder.setBindGroup(0, bindGroup, uniformOffsets);
+		passEncoder.setBindGroup(Module.wgpuAnyKernelHasBindings ? 1 : 0, Module.wgpuPrintfBindGroup);
+		passEncoder.dispatchWorkgroups(gx, gy, gz);
+		batch.dispatches++;
 
-			const kernelRan = { name: kernelName, bx, by, bz, gx, gy, gz };
-			Module.wgpuKernelsRan.push(kernelRan);
-			reportErr = (err) => {
-				kernelRan.status = err;
-			};
+		if (timestamp && Module.wgpuKernelsRan.length * 16 < Module.wgpuTimestampReadBuffer.size) {
+			wgpuEndPass(batch);
+			commandEncoder.resolveQuerySet(
+				Module.wgpuTimestampQuery,
+				0,
+				2,
+				Module.wgpuTimestampBuffer,
+				0
+			);
+			commandEncoder.copyBufferToBuffer(
+				Module.wgpuTimestampBuffer,
+				0,
+				Module.wgpuTimestampReadBuffer,
+				Module.wgpuKernelsRan.length * 16,
+				16
+			);
+		}
 
-			if (kernel.printf) {
-				commandEncoder.copyBufferToBuffer(
-					Module.wgpuPrintfBuffer,
-					0,
-					Module.wgpuPrintfStagingBuffer,
-					0,
-					Module.wgpuPrintfBuffer.size
-				);
-				// just clear the initial offset to clear the buffer
-				commandEncoder.clearBuffer(Module.wgpuPrintfBuffer, 0, 4);
-			}
-			if (abortBuffer) {
-				commandEncoder.copyBufferToBuffer(abortBuffer, 0, Module.wgpuAbortStagingBuffer, 0, 4);
-				commandEncoder.clearBuffer(abortBuffer);
-			}
+		const kernelRan = { name: kernel.name, bx, by, bz, gx, gy, gz };
+		Module.wgpuKernelsRan.push(kernelRan);
+		batch.kernels.push(kernelRan);
+		if (kernel.printf) batch.printf = true;
 
-			device.queue.submit([commandEncoder.finish()]);
+		if (abortBuffer) {
+			// Each launch's abort flag gets a word of the batch's shared readback
+			// buffer, so checking them costs one mapping per batch. An abort is
+			// reported by the next synchronization.
+			Module.wgpuPendingReadbacks ??= new Set();
+			const pending = wgpuReadback(
+				batch,
+				abortBuffer,
+				0,
+				(/** @type {Uint8Array} */ data) => {
+					if (!new Uint32Array(data.slice().buffer)[0]) return;
+					kernelRan.status = 'aborted';
+					Module.wgpuAbort ??= kernelRan;
+				},
+				4
+			).then(() => Module.wgpuPendingReadbacks.delete(pending));
+			Module.wgpuPendingReadbacks.add(pending);
+			commandEncoder.clearBuffer(abortBuffer);
+		}
 
-			let abortBufferPromise;
-			if (abortBuffer) {
-				abortBufferPromise = Module.wgpuAbortStagingBuffer.mapAsync(GPUMapMode.READ);
-			}
-			if (kernel.printf) {
-				await Module.wgpuPrintfStagingBuffer.mapAsync(GPUMapMode.READ);
-				const printf = new Uint8Array(Module.wgpuPrintfStagingBuffer.getMappedRange());
-				// only copy as much data as was actually used
-				const words = new Uint32Array(printf.buffer)[0] + 1;
-				HEAPU8.set(printf.subarray(0, words * 4), printfBuffer);
-				Module.wgpuPrintfStagingBuffer.unmap();
-			} else {
-				HEAPU32[printfBuffer / 4] = 0;
+		const submitted = batch.dispatches >= 256 ? wgpuFlush() : undefined;
+		const error = await device.popErrorScope();
+		if (error) {
+			kernelRan.status = error.message;
+			throw error;
+		}
+		if (await submitted) return 1;
+	},
+	/**
+	 * hipErrorAssert if a kernel has aborted, reporting the first launch that
+	 * did. Like a device-side assert in CUDA, this is sticky.
+	 */
+	$wgpuAbortStatus() {
+		const kernelRan = Module.wgpuAbort;
+		if (!kernelRan) return 0;
+		if (!kernelRan.reported) {
+			kernelRan.reported = true;
+			const { name, gx, gy, gz, bx, by, bz } = kernelRan;
+			err(`${name}<<<(${gx},${gy},${gz}), (${bx},${by},${bz})>>> aborted`);
+		}
+		return 710; // hipErrorAssert
+	},
+	/**
+	 * Describe a kernel's arguments and give it an id, which launches use to
+	 * find the kernel without looking up its name
+	 */
+	wasm_hipKernelInfo(
+		/** @type {number} */ kernelPtr,
+		/** @type {number} */ argSizes,
+		/** @type {number} */ argIsBuffer,
+		/** @type {number} */ maxArgs,
+		/** @type {number} */ kernelId
+	) {
+		const kernel = Module.wgpuKernelMap.get(UTF8ToString(kernelPtr));
+		if (!kernel) return -1;
+		Module.wgpuKernels ??= [];
+		kernel.id ??= Module.wgpuKernels.push(kernel) - 1;
+		HEAPU32[kernelId / 4] = kernel.id;
+		// the reflection data is all strings, so parse what launches use once
+		kernel.launchArgs ??= kernel.args.map(
+			(/** @type {any} */ { arg, argOrdinal, argKind, binding, argSize, offset }) => ({
+				global: arg.startsWith('_chip_var_') && arg,
+				abort: arg === '_chip_var___chipspv_abort_called',
+				ordinal: +argOrdinal,
+				isBuffer: argKind === 'buffer',
+				binding: +binding,
+				size: +argSize,
+				offset: +offset
+			})
+		);
+		let count = 0;
+		for (const { arg, argOrdinal, argKind, argSize } of kernel.args) {
+			if (arg.startsWith('_chip_var_')) continue;
+			const ordinal = +argOrdinal;
+			if (ordinal >= maxArgs) continue;
+			for (; count <= ordinal; count++) {
+				HEAPU32[argSizes / 4 + count] = 0;
+				HEAPU8[argIsBuffer + count] = 0;
 			}
-			if (abortBuffer) {
-				await abortBufferPromise;
-				const aborted = new Uint32Array(Module.wgpuAbortStagingBuffer.getMappedRange())[0];
-				Module.wgpuAbortStagingBuffer.unmap();
-				if (aborted) {
-					kernelRan.status = 'aborted';
-					return 710; // hipErrorAssert
-				}
+			if (argKind === 'buffer') {
+				HEAPU8[argIsBuffer + ordinal] = 1;
+				continue;
 			}
+			const size = +argSize;
+			HEAPU32[argSizes / 4 + ordinal] = Math.max(HEAPU32[argSizes / 4 + ordinal], size);
 		}
+		return count;
+	},
+	wasm_hipLaunchKernel__deps: ['$wgpuEnqueue', '$wgpuLaunch'],
+	wasm_hipLaunchKernel(
+		/** @type {number} */ stream,
+		/** @type {number} */ kernelId,
+		/** @type {number} */ gx,
+		/** @type {number} */ gy,
+		/** @type {number} */ gz,
+		/** @type {number} */ bx,
+		/** @type {number} */ by,
+		/** @type {number} */ bz,
+		/** @type {number} */ Args,
+		/** @type {number} */ SharedMem
+	) {
+		const kernel = Module.wgpuKernels[kernelId];
+		// errors from the launch are reported by the next synchronization
+		wgpuEnqueue(
+			stream,
+			() => wgpuLaunch(stream, kernel, gx, gy, gz, bx, by, bz, Args, SharedMem),
+			true
+		);
+	},
+	wasm_hipStreamCreate__deps: ['$wgpuStream'],
+	wasm_hipStreamCreate(/** @type {number} */ id, /** @type {number} */ nonBlocking) {
+		wgpuStream(id).nonBlocking = !!nonBlocking;
+	},
+	wasm_hipStreamDestroy(/** @type {number} */ id) {
+		const stream = Module.wgpuStreams.get(id);
+		stream?.tail.then(() => Module.wgpuStreams.delete(id));
+	},
+	wasm_hipStreamSynchronize__deps: ['$wgpuStream', '$wgpuDrain'],
+	wasm_hipStreamSynchronize: asyncify([], async (/** @type {number} */ id) => {
+		// the null stream also synchronizes with every blocking stream
+		const streams =
+			id === 0
+				? [...Module.wgpuStreams.values()].filter((stream) => !stream.nonBlocking)
+				: [wgpuStream(id)];
+		return wgpuDrain(streams);
+	}),
+	wasm_hipDeviceSynchronize__deps: ['$wgpuDrain'],
+	wasm_hipDeviceSynchronize: asyncify([], async () =>
+		wgpuDrain([...Module.wgpuStreams.values()])
 	),
+	/**
+	 * Hand freed device memory back to the allocator once the work queued before
+	 * the free has been recorded. Later work is submitted after it, so the
+	 * memory can be reused right away; only a buffer that is destroyed (id is
+	 * nonzero) has to wait for the batch holding that work.
+	 */
+	wasm_hipFree__deps: ['$wgpuFlush', '$wgpuForgetBuffer', 'wasm_releaseDeviceMemory'],
+	wasm_hipFree(/** @type {number} */ ptr, /** @type {number} */ id) {
+		Promise.all([...Module.wgpuStreams.values()].map((stream) => stream.tail)).then(async () => {
+			if (id) {
+				await wgpuFlush();
+				wgpuForgetBuffer(id);
+				WebGPU.mgrBuffer.get(id).destroy();
+				WebGPU.mgrBuffer.release(id);
+			}
+			_wasm_releaseDeviceMemory(ptr);
+		});
+	},
 	wasm_hipRegisterVar(
 		/** @type {number} */ bufferPtr,
 		/** @type {number} */ namePtr,
@@ -242,18 +724,8 @@ addToLibrary({
 			// }) :
 			buffer;
 
-		const computePipeline = device.createComputePipeline({
-			layout: initKernel.pipelineLayout,
-			compute: {
-				module: Module.wgpuShaderModule,
-				entryPoint: initKernelName,
-				constants: {
-					_cuda_wgx: 1,
-					_cuda_wgy: 1,
-					_cuda_wgz: 1
-				}
-			}
-		});
+		// prewarmed before the module was loaded
+		const computePipeline = Module.wgpuGetPipeline(initKernel, 1, 1, 1, undefined, true);
 
 		// Create bind group
 		const bindGroup = device.createBindGroup({
@@ -274,59 +746,403 @@ addToLibrary({
 
 		device.queue.submit([commandEncoder.finish()]);
 	},
-	wasm_hipMemcpy: asyncify(
-		['validation'],
-		async (
-			/** @type {number} */ dstId,
-			/** @type {number} */ srcId,
-			/** @type {number} */ sizeBytes,
-			/** @type {number} */ kind
-		) => {
-			switch (kind) {
-				case 1: {
-					// hipMemcpyHostToDevice
-					const dst = WebGPU.mgrBuffer.get(dstId / 8);
-					window.wgpuDevice.queue.writeBuffer(dst, 0, HEAPU8, srcId, sizeBytes);
-					return 0;
+	/**
+	 * Offsets of the rows of a strided copy, relative to the start of the
+	 * destination and source. A plain copy is a single row.
+	 */
+	$wgpuCopyRows(/** @type {any} */ shape) {
+		const rows = [];
+		for (let z = 0; z < shape.depth; z++)
+			for (let y = 0; y < shape.height; y++)
+				rows.push({
+					dst: z * shape.dstSlicePitch + y * shape.dstPitch,
+					src: z * shape.srcSlicePitch + y * shape.srcPitch
+				});
+		return rows;
+	},
+	/**
+	 * Copy `shape.width` bytes per row for each row of `shape`. Every row of a
+	 * copy is recorded into the stream's batch, so strided copies are submitted
+	 * together rather than one round trip per row.
+	 */
+	$wgpuMemcpy__deps: ['$wgpuAbortStatus', 'free', '$wgpuBatch', '$wgpuEndPass', '$wgpuFlush', '$wgpuReadback', '$wgpuStream', '$wgpuCopyRows'],
+	async $wgpuMemcpy(
+		/** @type {number} */ stream,
+		/** @type {boolean} */ async,
+		/** @type {number} */ dstId,
+		/** @type {number} */ dstOffset,
+		/** @type {number} */ srcId,
+		/** @type {number} */ srcOffset,
+		/** @type {any} */ shape,
+		/** @type {number} */ kind
+	) {
+		const device = window.wgpuDevice;
+		const width = shape.width;
+		const rows = wgpuCopyRows(shape);
+		switch (kind) {
+			case 1: {
+				// hipMemcpyHostToDevice
+				const dst = WebGPU.mgrBuffer.get(dstId);
+				device.pushErrorScope('validation');
+				try {
+					if (rows.length > 1 || Module.wgpuBatch?.stream === stream) {
+						// queue.writeBuffer would land before the work already recorded in
+						// the batch, so record the copy from a staging buffer instead. Rows
+						// are packed into it.
+						const batch = wgpuBatch(stream);
+						const rowSize = (width + 3) & ~3;
+						const staging = device.createBuffer({
+							size: rowSize * rows.length,
+							usage: GPUBufferUsage.COPY_SRC,
+							mappedAtCreation: true
+						});
+						const data = new Uint8Array(staging.getMappedRange());
+						rows.forEach((row, i) =>
+							data.set(HEAPU8.subarray(srcId + row.src, srcId + row.src + width), i * rowSize)
+						);
+						staging.unmap();
+						wgpuEndPass(batch);
+						rows.forEach((row, i) =>
+							batch.encoder.copyBufferToBuffer(staging, i * rowSize, dst, dstOffset + row.dst, width)
+						);
+						// freed once the batch has executed
+						batch.staging.push(staging);
+					} else {
+						wgpuFlush();
+						device.queue.writeBuffer(dst, dstOffset, HEAPU8, srcId, width);
+					}
+				} finally {
+					// asynchronous copies get a snapshot of the source
+					if (async) _free(srcId);
 				}
-				case 2: {
-					// hipMemcpyDeviceToHost
+				const error = await device.popErrorScope();
+				if (error) throw error;
+				return 0;
+			}
+			case 2: {
+				// hipMemcpyDeviceToHost
+				const src = WebGPU.mgrBuffer.get(srcId);
+				device.pushErrorScope('validation');
+				const batch = wgpuBatch(stream);
+				const done = Promise.all(
+					rows.map((row) =>
+						wgpuReadback(batch, src, srcOffset + row.src, dstId + row.dst, width)
+					)
+				).then((results) => Math.max(...results));
+				const error = await device.popErrorScope();
+				if (error) throw error;
 
-					const src = WebGPU.mgrBuffer.get(srcId / 8);
-					const stagingBuffer = window.wgpuDevice.createBuffer({
-						size: sizeBytes,
-						usage: GPUBufferUsage.COPY_DST | GPUBufferUsage.MAP_READ,
-						mappedAtCreation: false
+				if (async) {
+					// Completes with the batch, so consecutive readbacks share a
+					// mapping. Synchronization waits for it.
+					Module.wgpuPendingReadbacks ??= new Set();
+					const pending = done.then((/** @type {number} */ res) => {
+						Module.wgpuPendingReadbacks.delete(pending);
+						if (res) wgpuStream(stream).error ||= res;
 					});
-
-					// Create and submit copy command
-					const commandEncoder = window.wgpuDevice.createCommandEncoder();
-					commandEncoder.copyBufferToBuffer(src, 0, stagingBuffer, 0, sizeBytes);
-					const commandBuffer = commandEncoder.finish();
-
-					// Submit, map and copy back
-					window.wgpuDevice.queue.submit([commandBuffer]);
-					await stagingBuffer.mapAsync(GPUMapMode.READ);
-
-					const copyArray = new Uint8Array(stagingBuffer.getMappedRange());
-					HEAPU8.set(copyArray, dstId);
-					stagingBuffer.unmap();
-					stagingBuffer.destroy();
+					Module.wgpuPendingReadbacks.add(pending);
 					return 0;
 				}
-				case 3: // hipMemcpyDeviceToDevice
-					const src = WebGPU.mgrBuffer.get(srcId / 8);
-					const dst = WebGPU.mgrBuffer.get(dstId / 8);
-					const commandEncoder = window.wgpuDevice.createCommandEncoder();
-					commandEncoder.copyBufferToBuffer(src, 0, dst, 0, sizeBytes);
-					const commandBuffer = commandEncoder.finish();
-
-					window.wgpuDevice.queue.submit([commandBuffer]);
-					return 0;
-
-				default:
-					return 1;
+				// The host reads the result, so this ends the batch. Earlier
+				// asynchronous readbacks land first.
+				wgpuFlush();
+				const res = await done;
+				await Promise.all(Module.wgpuPendingReadbacks ?? []);
+				return res || wgpuAbortStatus();
+			}
+			case 3: {
+				// hipMemcpyDeviceToDevice
+				const src = WebGPU.mgrBuffer.get(srcId);
+				const dst = WebGPU.mgrBuffer.get(dstId);
+				const batch = wgpuBatch(stream);
+				wgpuEndPass(batch);
+				for (const row of rows)
+					batch.encoder.copyBufferToBuffer(
+						src,
+						srcOffset + row.src,
+						dst,
+						dstOffset + row.dst,
+						width
+					);
+				return 0;
 			}
+			default:
+				return 1;
+		}
+	},
+	wasm_hipMemcpy__deps: ['$wgpuEnqueue', '$wgpuMemcpy'],
+	wasm_hipMemcpy(
+		/** @type {number} */ cb,
+		/** @type {number} */ data,
+		/** @type {number} */ res_p,
+		/** @type {number} */ stream,
+		/** @type {number} */ dstId,
+		/** @type {number} */ dstOffset,
+		/** @type {number} */ srcId,
+		/** @type {number} */ srcOffset,
+		/** @type {number} */ sizeBytes,
+		/** @type {number} */ kind
+	) {
+		const shape = {
+			width: sizeBytes,
+			height: 1,
+			depth: 1,
+			dstPitch: 0,
+			dstSlicePitch: 0,
+			srcPitch: 0,
+			srcSlicePitch: 0
+		};
+		const done = wgpuEnqueue(
+			stream,
+			() => wgpuMemcpy(stream, !cb, dstId, dstOffset, srcId, srcOffset, shape, kind),
+			!cb
+		);
+		if (cb)
+			done.then((res) => {
+				setValue(res_p, res, 'i32');
+				{{{ makeDynCall('vp', 'cb') }}}(data);
+			});
+	},
+	wasm_hipMemcpy3D__deps: ['$wgpuEnqueue', '$wgpuMemcpy'],
+	wasm_hipMemcpy3D(
+		/** @type {number} */ cb,
+		/** @type {number} */ data,
+		/** @type {number} */ res_p,
+		/** @type {number} */ stream,
+		/** @type {number} */ dstId,
+		/** @type {number} */ dstOffset,
+		/** @type {number} */ dstPitch,
+		/** @type {number} */ dstSlicePitch,
+		/** @type {number} */ srcId,
+		/** @type {number} */ srcOffset,
+		/** @type {number} */ srcPitch,
+		/** @type {number} */ srcSlicePitch,
+		/** @type {number} */ width,
+		/** @type {number} */ height,
+		/** @type {number} */ depth,
+		/** @type {number} */ kind
+	) {
+		const shape = { width, height, depth, dstPitch, dstSlicePitch, srcPitch, srcSlicePitch };
+		const done = wgpuEnqueue(
+			stream,
+			() => wgpuMemcpy(stream, !cb, dstId, dstOffset, srcId, srcOffset, shape, kind),
+			!cb
+		);
+		if (cb)
+			done.then((res) => {
+				setValue(res_p, res, 'i32');
+				{{{ makeDynCall('vp', 'cb') }}}(data);
+			});
+	},
+	/**
+	 * Fills that aren't zero, or don't cover whole words, use a built-in shader.
+	 * Each invocation writes one word of the range, masking off the bytes of the
+	 * first and last words that lie outside it.
+	 */
+	$wgpuFillPipeline() {
+		if (!Module.wgpuFillPipeline) {
+			const device = window.wgpuDevice;
+			const module = device.createShaderModule({
+				code: `
+struct Params { start: u32, end: u32, pattern: u32 }
+@group(0) @binding(0) var<storage, read_write> dst: array<u32>;
+@group(0) @binding(1) var<uniform> params: Params;
+@compute @workgroup_size(64)
+fn main(@builtin(global_invocation_id) id: vec3u, @builtin(num_workgroups) n: vec3u) {
+	let word = params.start / 4u + id.x + id.y * n.x * 64u;
+	if (word * 4u >= params.end) { return; }
+	let lo = max(params.start, word * 4u) - word * 4u;
+	let hi = min(params.end, word * 4u + 4u) - word * 4u;
+	let mask = select(0xffffffffu, (1u << (hi * 8u)) - 1u, hi < 4u) & ~((1u << (lo * 8u)) - 1u);
+	dst[word] = (dst[word] & ~mask) | (params.pattern & mask);
+}`
+			});
+			const layout = device.createBindGroupLayout({
+				entries: [
+					{ binding: 0, visibility: GPUShaderStage.COMPUTE, buffer: { type: 'storage' } },
+					{
+						binding: 1,
+						visibility: GPUShaderStage.COMPUTE,
+						buffer: { type: 'uniform', hasDynamicOffset: true }
+					}
+				]
+			});
+			Module.wgpuFillPipeline = device.createComputePipeline({
+				layout: device.createPipelineLayout({ bindGroupLayouts: [layout] }),
+				compute: { module, entryPoint: 'main' }
+			});
+		}
+		return Module.wgpuFillPipeline;
+	},
+	$wgpuMemset__deps: ['$wgpuBatch', '$wgpuComputePass', '$wgpuEndPass', '$wgpuFillPipeline', '$wgpuUniformAlloc'],
+	async $wgpuMemset(
+		/** @type {number} */ stream,
+		/** @type {number} */ dstId,
+		/** @type {number} */ dstOffset,
+		/** @type {number} */ value,
+		/** @type {number} */ elementSize,
+		/** @type {number} */ sizeBytes
+	) {
+		const device = window.wgpuDevice;
+		const dst = WebGPU.mgrBuffer.get(dstId);
+		// the value repeated across a word
+		const pattern =
+			elementSize === 1 ? value * 0x01010101 : elementSize === 2 ? value * 0x00010001 : value;
+		if (pattern === 0 && dstOffset % 4 === 0 && sizeBytes % 4 === 0) {
+			const batch = wgpuBatch(stream);
+			wgpuEndPass(batch);
+			batch.encoder.clearBuffer(dst, dstOffset, sizeBytes);
+			return 0;
 		}
-	)
+
+		const pipeline = wgpuFillPipeline();
+		const params = await wgpuUniformAlloc(16);
+		const paramsOffset = params.offset;
+		const arena = Module.wgpuUniformArena;
+		// bind from an aligned offset and fill relative to it
+		const bindOffset = dstOffset - (dstOffset % device.limits.minStorageBufferOffsetAlignment);
+		const start = dstOffset - bindOffset;
+		const end = start + sizeBytes;
+		device.queue.writeBuffer(arena.buffer, paramsOffset, new Uint32Array([start, end, pattern, 0]));
+		device.pushErrorScope('validation');
+		const bindGroup = device.createBindGroup({
+			layout: pipeline.getBindGroupLayout(0),
+			entries: [
+				{ binding: 0, resource: { buffer: dst, offset: bindOffset, size: (end + 3) & ~3 } },
+				{ binding: 1, resource: { buffer: arena.buffer, size: 16 } }
+			]
+		});
+		const workgroups = Math.ceil((Math.ceil(end / 4) - Math.floor(start / 4)) / 64);
+		const x = Math.min(workgroups, device.limits.maxComputeWorkgroupsPerDimension);
+		const batch = wgpuBatch(stream);
+		batch.uniforms.push(params);
+		const pass = wgpuComputePass(batch);
+		pass.setPipeline(pipeline);
+		pass.setBindGroup(0, bindGroup, [paramsOffset]);
+		pass.dispatchWorkgroups(x, Math.ceil(workgroups / x));
+		batch.dispatches++;
+		const error = await device.popErrorScope();
+		if (error) throw error;
+		return 0;
+	},
+	wasm_hipMemset__deps: ['$wgpuEnqueue', '$wgpuMemset'],
+	wasm_hipMemset(
+		/** @type {number} */ stream,
+		/** @type {number} */ dstId,
+		/** @type {number} */ dstOffset,
+		/** @type {number} */ value,
+		/** @type {number} */ elementSize,
+		/** @type {number} */ sizeBytes
+	) {
+		wgpuEnqueue(
+			stream,
+			() => wgpuMemset(stream, dstId, dstOffset, value, elementSize, sizeBytes),
+			true
+		);
+	},
+	/**
+	 * Timestamp query slots for events come from a pool of query sets that
+	 * grows as needed. A slot is returned once its value has been read back.
+	 */
+	$wgpuQuerySlot() {
+		const pool = (Module.wgpuQueryPool ??= { free: [] });
+		if (!pool.free.length) {
+			const device = window.wgpuDevice;
+			const count = 64;
+			const set = device.createQuerySet({ type: 'timestamp', count });
+			// resolveQuerySet needs 256-byte aligned destinations
+			const resolve = device.createBuffer({
+				size: count * 256,
+				usage: GPUBufferUsage.QUERY_RESOLVE | GPUBufferUsage.COPY_SRC
+			});
+			for (let index = count - 1; index >= 0; index--) pool.free.push({ set, resolve, index });
+		}
+		return pool.free.pop();
+	},
+	/**
+	 * Record an event on the batch. With timestamp queries the event is an
+	 * empty compute pass that writes a timestamp; otherwise (or if the event
+	 * isn't used for timing) the batch is submitted and the event's time is
+	 * taken when it has finished.
+	 */
+	$wgpuEventRecord__deps: ['$wgpuBatch', '$wgpuEndPass', '$wgpuFlush', '$wgpuQuerySlot', '$wgpuReadback', '$wgpuStream'],
+	async $wgpuEventRecord(/** @type {number} */ stream, /** @type {any} */ event) {
+		const device = window.wgpuDevice;
+		if (!event.timing || !device.features.has('timestamp-query')) {
+			event.complete = wgpuFlush()
+				.then(() => device.queue.onSubmittedWorkDone())
+				.then(() => (event.time = performance.now()));
+			return 0;
+		}
+		const slot = wgpuQuerySlot();
+		const batch = wgpuBatch(stream);
+		wgpuEndPass(batch);
+		batch.encoder
+			.beginComputePass({
+				timestampWrites: { querySet: slot.set, beginningOfPassWriteIndex: slot.index }
+			})
+			.end();
+		batch.encoder.resolveQuerySet(slot.set, slot.index, 1, slot.resolve, slot.index * 256);
+		event.complete = wgpuReadback(
+			batch,
+			slot.resolve,
+			slot.index * 256,
+			(/** @type {Uint8Array} */ data) => {
+				// nanoseconds
+				event.time = Number(new BigUint64Array(data.slice().buffer)[0]) / 1e6;
+			},
+			8
+		).then((/** @type {number} */ res) => {
+			Module.wgpuQueryPool.free.push(slot);
+			if (res) wgpuStream(stream).error ||= res;
+		});
+		return 0;
+	},
+	wasm_hipEventRecord__deps: ['$wgpuEnqueue', '$wgpuEventRecord'],
+	wasm_hipEventRecord(
+		/** @type {number} */ id,
+		/** @type {number} */ stream,
+		/** @type {number} */ timing
+	) {
+		Module.wgpuEvents ??= new Map();
+		const event = { timing: !!timing, time: undefined, complete: undefined };
+		Module.wgpuEvents.set(id, event);
+		event.recorded = wgpuEnqueue(stream, () => wgpuEventRecord(stream, event), true);
+	},
+	wasm_hipEventDestroy(/** @type {number} */ id) {
+		Module.wgpuEvents?.delete(id);
+	},
+	wasm_hipEventSynchronize__deps: ['$wgpuFlush', '$wgpuAbortStatus'],
+	wasm_hipEventSynchronize: asyncify([], async (/** @type {number} */ id) => {
+		const event = Module.wgpuEvents?.get(id);
+		// an event that was never recorded has nothing to wait for
+		if (!event) return 0;
+		const res = await event.recorded;
+		if (res) return res;
+		await wgpuFlush();
+		await event.complete;
+		await Promise.all(Module.wgpuPendingReadbacks ?? []);
+		return wgpuAbortStatus();
+	}),
+	wasm_hipEventQuery(/** @type {number} */ id) {
+		const event = Module.wgpuEvents?.get(id);
+		return !event || event.time !== undefined ? 0 : 600; // hipErrorNotReady
+	},
+	wasm_hipEventElapsedTime(
+		/** @type {number} */ ms,
+		/** @type {number} */ startId,
+		/** @type {number} */ stopId
+	) {
+		const start = Module.wgpuEvents?.get(startId);
+		const stop = Module.wgpuEvents?.get(stopId);
+		if (!start?.timing || !stop?.timing) return 400; // hipErrorInvalidHandle
+		if (start.time === undefined || stop.time === undefined) return 600; // hipErrorNotReady
+		HEAPF32[ms / 4] = stop.time - start.time;
+		return 0;
+	},
+	/** Warps are subgroups; 0 unless the adapter always uses one subgroup size */
+	wasm_hipWarpSize() {
+		const { subgroupMinSize, subgroupMaxSize } = window.wgpuDevice.adapterInfo ?? {};
+		return subgroupMinSize && subgroupMinSize === subgroupMaxSize ? subgroupMinSize : 0;
+	}
 });
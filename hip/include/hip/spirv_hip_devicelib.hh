@@ -152,27 +152,20 @@ __HIP_OVERLOAD1(double, tan);
 
 /**********************************************************************/
 
-// TODO: This is a temporary implementation of clock64(),
-//       in future it will be changed with more reliable implementation.
-__device__ static unsigned long long __chip_clk_counter = 0;
+// Neither WGSL nor WebGPU has a shader clock, so clock64() counts reads in
+// work-group memory instead, which WGSL zero-initializes. The values increase
+// within a block, and blocks don't contend on a single global atomic, but they
+// can't be compared between blocks and don't measure time. The counter is 32
+// bits wide because WGSL has no 64-bit atomics.
 EXPORT unsigned long long clock64() {
-  atomicAdd(&__chip_clk_counter, 1);
-  return __chip_clk_counter;
+  __shared__ unsigned int __chip_clk_counter;
+  return atomicAdd(&__chip_clk_counter, 1u) + 1;
 }
-// TODO: This is a temporary implementation of clock(),
-//       in future it will be changed with more reliable implementation.
-//       It is encouraged to use clock64() over clock() so that chance of data
-//       loss can be avoided.
+// It is encouraged to use clock64() over clock() so that chance of data loss
+// can be avoided.
 EXPORT clock_t clock() { return (clock_t)clock64(); }
 
-EXPORT unsigned long long wall_clock64() {
-  atomicAdd(&__chip_clk_counter, 1);
-  return __chip_clk_counter;
-}
-// TODO: This is a temporary implementation of clock(),
-//       in future it will be changed with more reliable implementation.
-//       It is encouraged to use clock64() over clock() so that chance of data
-//       loss can be avoided.
+EXPORT unsigned long long wall_clock64() { return clock64(); }
 EXPORT clock_t wall_clock() { return (clock_t)wall_clock64(); }
 
 #include <hip/spirv_hip_runtime.h>